@@ -0,0 +1,232 @@
+/** @file Defines the class cu::BoundedConcurrentQueue.
+ * @author Ralph Tandetzky
+ */
+
+#pragma once
+
+#include "c++17_features.hpp"
+#include "event_count.hpp"
+#include "memory_helpers.hpp"
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+
+namespace cu
+{
+
+/// Lock-free bounded thread-safe queue.
+///
+/// This class has the same interface as @c ConcurrentQueue, but the
+/// elements are stored in a ring buffer of fixed capacity which is allocated
+/// once at construction. Pushing and popping elements neither allocates
+/// memory nor locks a mutex. Consumers only park, if the queue is empty, and
+/// producers only park, if the queue is full.
+///
+/// The implementation supports arbitrary numbers of consumer and producer
+/// threads. Each cell of the ring buffer carries a sequence number which
+/// tells whether the cell is ready to be written or to be read
+/// (see Dmitry Vyukov's bounded MPMC queue).
+///
+/// The type @c T must be nothrow move constructible.
+template <typename T>
+class BoundedConcurrentQueue
+{
+public:
+  /// Creates a queue which can hold at least @c minCapacity elements.
+  ///
+  /// The capacity is rounded up to the next power of two.
+  ///
+  /// @throws std::length_error if the rounded capacity is not representable.
+  explicit BoundedConcurrentQueue( std::size_t minCapacity = 1024 )
+    : mask( detail::roundUpToPowerOfTwo( minCapacity ) - 1 )
+    , cells( std::make_unique<Cell[]>( mask + 1 ) )
+  {
+    for ( std::size_t i = 0; i <= mask; ++i )
+      cells[i].sequence.store( i, std::memory_order_relaxed );
+  }
+
+  BoundedConcurrentQueue( const BoundedConcurrentQueue & ) = delete;
+  BoundedConcurrentQueue & operator=( const BoundedConcurrentQueue & ) = delete;
+
+  /// Destroys the remaining elements.
+  ~BoundedConcurrentQueue()
+  {
+    while ( tryPop() )
+    {
+    }
+  }
+
+  /// Copies an item into the queue.
+  ///
+  /// If the queue is full, then the function will block until there is
+  /// space. This function provides the strong exception guarantee.
+  void push( const T & item )
+  {
+    emplace( item );
+  }
+
+  /// Moves an item into the queue.
+  ///
+  /// If the queue is full, then the function will block until there is
+  /// space. This function provides the strong exception guarantee.
+  void push( T && item )
+  {
+    emplace( std::move(item) );
+  }
+
+  /// Emplaces an item into the queue, i. e. constructor arguments are forwarded.
+  ///
+  /// If the queue is full, then the function will block until there is
+  /// space. This function provides the strong exception guarantee.
+  template <typename ...Args>
+  void emplace( Args &&... args )
+  {
+    T item( std::forward<Args>(args)... );
+    notFull.wait( [&]{ return tryPushImpl( item ); } );
+    notEmpty.notifyOne();
+  }
+
+  /// Moves an item into the queue, if it is not full.
+  ///
+  /// @returns @c false, if the queue was full. In this case, @c item is
+  /// left untouched.
+  bool tryPush( T && item )
+  {
+    if ( !tryPushImpl( item ) )
+      return false;
+    notEmpty.notifyOne();
+    return true;
+  }
+
+  /// Pops an item from the queue and returns it.
+  ///
+  /// If there's no item in the queue, then the function will block until there
+  /// is one.
+  T pop()
+  {
+    optional<T> result;
+    notEmpty.wait( [&]{ return tryPopImpl( result ); } );
+    notFull.notifyOne();
+    return std::move( *result );
+  }
+
+  /// Pops an item off the queue without blocking.
+  ///
+  /// @returns @c std::nullopt, if the queue is empty.
+  optional<T> tryPop()
+  {
+    optional<T> result;
+    if ( tryPopImpl( result ) )
+      notFull.notifyOne();
+    return result;
+  }
+
+  /// Pops an item off the queue, blocking for at most @c maxWaitDuration.
+  ///
+  /// If the queue is empty for @c maxWaitDuration, then
+  /// @c std::nullopt is returned.
+  /// Otherwise this function returns the popped element.
+  template <typename Rep,
+            typename Period>
+  optional<T> tryPopFor(
+      const std::chrono::duration<Rep, Period> & maxWaitDuration )
+  {
+    optional<T> result;
+    const auto success = notEmpty.waitUntil(
+          [&]{ return tryPopImpl( result ); },
+          std::chrono::steady_clock::now() + maxWaitDuration );
+    if ( success )
+      notFull.notifyOne();
+    return result;
+  }
+
+  /// Returns the maximum number of elements the queue can hold.
+  std::size_t capacity() const noexcept
+  {
+    return mask + 1;
+  }
+
+private:
+  static_assert( std::is_nothrow_move_constructible<T>::value,
+                 "The item type must be nothrow move constructible, since "
+                 "elements are moved into and out of the ring buffer after "
+                 "their cell has been claimed." );
+
+  struct Cell
+  {
+    std::atomic<std::size_t> sequence;
+    typename std::aligned_storage<sizeof(T),alignof(T)>::type storage;
+
+    T * get() noexcept
+    {
+      return reinterpret_cast<T*>( &storage );
+    }
+  };
+
+  /// Moves @c item into a free cell, if there is one.
+  bool tryPushImpl( T & item ) noexcept
+  {
+    auto pos = enqueuePos.load( std::memory_order_relaxed );
+    for (;;)
+    {
+      auto & cell = cells[pos & mask];
+      const auto seq = cell.sequence.load( std::memory_order_acquire );
+      const auto diff = static_cast<std::intptr_t>( seq - pos );
+      if ( diff == 0 )
+      {
+        if ( enqueuePos.compare_exchange_weak(
+               pos, pos + 1, std::memory_order_relaxed ) )
+        {
+          ::new( static_cast<void*>( cell.get() ) ) T( std::move(item) );
+          cell.sequence.store( pos + 1, std::memory_order_release );
+          return true;
+        }
+      }
+      else if ( diff < 0 )
+        return false;
+      else
+        pos = enqueuePos.load( std::memory_order_relaxed );
+    }
+  }
+
+  /// Moves the front element into @c result, if there is one.
+  bool tryPopImpl( optional<T> & result ) noexcept
+  {
+    auto pos = dequeuePos.load( std::memory_order_relaxed );
+    for (;;)
+    {
+      auto & cell = cells[pos & mask];
+      const auto seq = cell.sequence.load( std::memory_order_acquire );
+      const auto diff = static_cast<std::intptr_t>( seq - (pos + 1) );
+      if ( diff == 0 )
+      {
+        if ( dequeuePos.compare_exchange_weak(
+               pos, pos + 1, std::memory_order_relaxed ) )
+        {
+          result.emplace( std::move( *cell.get() ) );
+          cell.get()->~T();
+          cell.sequence.store( pos + mask + 1, std::memory_order_release );
+          return true;
+        }
+      }
+      else if ( diff < 0 )
+        return false;
+      else
+        pos = dequeuePos.load( std::memory_order_relaxed );
+    }
+  }
+
+  const std::size_t mask;
+  const std::unique_ptr<Cell[]> cells;
+  alignas(cacheLineSize) std::atomic<std::size_t> enqueuePos{0};
+  alignas(cacheLineSize) std::atomic<std::size_t> dequeuePos{0};
+  alignas(cacheLineSize) EventCount notEmpty;
+  EventCount notFull;
+};
+
+} // namespace cu
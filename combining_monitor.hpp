@@ -0,0 +1,309 @@
+/** @file Defines the template class @c cu::CombiningMonitor which implements
+ * the monitor pattern with flat combining.
+ *
+ * @author Ralph Tandetzky
+ */
+
+#pragma once
+
+#include "c++17_features.hpp"
+#include "memory_helpers.hpp"
+#include "scope_guard.hpp"
+#include "swap.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+namespace cu
+{
+
+namespace detail
+{
+  /// Returns a small number, which identifies the calling thread.
+  inline std::size_t combiningThreadNumber()
+  {
+    static std::atomic<std::size_t> nThreads{0};
+    static thread_local const std::size_t result =
+        nThreads.fetch_add( 1, std::memory_order_relaxed );
+    return result;
+  }
+
+  /// Stores the result of a call to @c g passed to @c set(), which may be
+  /// a value, a reference or @c void.
+  template <typename R>
+  class CombiningResult
+  {
+  public:
+    template <typename G>
+    void set( G && g )
+    {
+      value.emplace( g() );
+    }
+
+    R get()
+    {
+      return std::move( *value );
+    }
+
+  private:
+    optional<R> value;
+  };
+
+  template <typename R>
+  class CombiningResult<R&>
+  {
+  public:
+    template <typename G>
+    void set( G && g )
+    {
+      value = &g();
+    }
+
+    R & get()
+    {
+      return *value;
+    }
+
+  private:
+    R * value = nullptr;
+  };
+
+  template <typename R>
+  class CombiningResult<R&&>
+  {
+  public:
+    template <typename G>
+    void set( G && g )
+    {
+      value = &g();
+    }
+
+    R && get()
+    {
+      return std::move( *value );
+    }
+
+  private:
+    R * value = nullptr;
+  };
+
+  template <>
+  class CombiningResult<void>
+  {
+  public:
+    template <typename G>
+    void set( G && g )
+    {
+      g();
+    }
+
+    void get()
+    {}
+  };
+} // namespace detail
+
+
+/// A monitor for heavily contended objects, which combines the operations
+/// of concurrent callers.
+///
+/// This class has the same function call operators as @c Monitor. If the
+/// mutex is free, then the functor is executed right away. Otherwise the
+/// caller publishes its functor in a slot of its own and waits. Whichever
+/// thread holds the mutex executes all published functors in one pass
+/// before it unlocks. Hence, the wrapped object stays in the cache of one
+/// core for many operations instead of moving between the cores with every
+/// lock handoff. Results and exceptions are passed back to the callers.
+///
+/// This pays off, if many threads perform short operations on the same
+/// object. Waiting callers spin and yield instead of sleeping, so the
+/// functors should not block. Condition variables are not supported, since
+/// a functor may be executed by another thread without the caller holding
+/// the lock.
+///
+/// Each thread uses the slot given by its thread number modulo @c nSlots.
+/// If it is occupied, the next free slot is used.
+template <typename T,
+          std::size_t nSlots = 64>
+class CombiningMonitor
+{
+public:
+  /// Forwards all arguments to the wrapped type's constructor.
+  template <typename ...Args>
+  CombiningMonitor( Args &&... args )
+    : item( std::forward<Args>(args)... )
+  {
+  }
+
+  /// Applies the passed functor to the wrapped item, while the mutex is
+  /// locked by the calling or another thread.
+  ///
+  /// @returns whatever the functor returns.
+  template <typename F>
+  decltype(auto) operator()( F && f )
+  {
+    return apply<T>( std::forward<F>(f) );
+  }
+
+  /// Applies the passed functor to the wrapped item, while the mutex is
+  /// locked by the calling or another thread.
+  ///
+  /// @returns whatever the functor returns.
+  template <typename F>
+  decltype(auto) operator()( F && f ) const
+  {
+    return apply<const T>( std::forward<F>(f) );
+  }
+
+  /// Atomically swaps the contents of @c this object with the @c other object.
+  void exchange( T & other )
+  {
+    (*this)( [&]( T & mine ){ ::cu::swap( mine, other ); } );
+  }
+
+  void exchange( T && other )
+  {
+    exchange( other );
+  }
+
+  /// Returns the contents of this object.
+  T load() const
+  {
+    return (*this)( []( const T & item ){ return item; } );
+  }
+
+private:
+  struct Operation
+  {
+    void (*execute)( Operation & self, T & item ) noexcept;
+    std::atomic<bool> done{false};
+  };
+
+  /// An operation, which lives on the stack of the waiting caller.
+  template <typename F,
+            typename Item>
+  struct TypedOperation
+      : Operation
+  {
+    using Result = decltype( std::declval<F>()( std::declval<Item&>() ) );
+
+    explicit TypedOperation( F & f_ )
+      : f( f_ )
+    {
+      this->execute = []( Operation & self, T & item ) noexcept
+      {
+        auto & op = static_cast<TypedOperation &>( self );
+        try
+        {
+          Item & arg = item;
+          op.result.set( [&]() -> Result
+          {
+            return std::forward<F>(op.f)( arg );
+          } );
+        }
+        catch ( ... )
+        {
+          op.error = std::current_exception();
+        }
+      };
+    }
+
+    F & f;
+    detail::CombiningResult<Result> result;
+    std::exception_ptr error;
+  };
+
+  struct alignas(cacheLineSize) Slot
+  {
+    std::atomic<Operation*> pending{nullptr};
+  };
+
+  template <typename Item,
+            typename F>
+  decltype(auto) apply( F && f ) const
+  {
+    if ( mutex.try_lock() )
+    {
+      CU_SCOPE_EXIT
+      {
+        combine();
+        mutex.unlock();
+      };
+      Item & arg = item;
+      return std::forward<F>(f)( arg );
+    }
+
+    TypedOperation<F, Item> op( f );
+    publish( op );
+    while ( !op.done.load( std::memory_order_acquire ) )
+    {
+      if ( mutex.try_lock() )
+      {
+        combine();
+        mutex.unlock();
+      }
+      else
+        std::this_thread::yield();
+    }
+    if ( op.error )
+      std::rethrow_exception( op.error );
+    return op.result.get();
+  }
+
+  /// Puts the operation into a free slot.
+  void publish( Operation & op ) const
+  {
+    for ( auto index = detail::combiningThreadNumber() % nSlots; ;
+          index = ( index + 1 ) % nSlots )
+    {
+      auto & slot = slots[index];
+      Operation * expected = nullptr;
+      if ( slot.pending.load( std::memory_order_relaxed ) == nullptr &&
+           slot.pending.compare_exchange_strong(
+             expected, &op, std::memory_order_release,
+             std::memory_order_relaxed ) )
+      {
+        auto nUsed = nUsedSlots.load( std::memory_order_relaxed );
+        while ( nUsed <= index &&
+                !nUsedSlots.compare_exchange_weak(
+                  nUsed, index + 1, std::memory_order_release,
+                  std::memory_order_relaxed ) )
+        {}
+        return;
+      }
+    }
+  }
+
+  /// Executes the published operations.
+  ///
+  /// The mutex must be locked.
+  void combine() const noexcept
+  {
+    const auto nUsed = nUsedSlots.load( std::memory_order_acquire );
+    for ( std::size_t i = 0; i < nUsed; ++i )
+    {
+      auto & pending = slots[i].pending;
+      const auto op = pending.load( std::memory_order_acquire );
+      if ( !op )
+        continue;
+      op->execute( *op, item );
+      // The slot must be free before the caller returns and publishes its
+      // next operation. Afterwards, the operation must not be touched.
+      pending.store( nullptr, std::memory_order_relaxed );
+      op->done.store( true, std::memory_order_release );
+    }
+  }
+
+  mutable T item;
+  mutable std::mutex mutex;
+  /// One plus the highest index of a slot, which has ever been used.
+  mutable std::atomic<std::size_t> nUsedSlots{0};
+  mutable std::array<Slot, nSlots> slots;
+};
+
+} // namespace cu
@@ -26,6 +26,8 @@ namespace cu
 ///
 /// Alternatively, a reference type like @c cu::TaskQueueThread& can be
 /// chosen as executor, or, types which distribute the work on threadpools.
+/// A @c cu::Strand runs the functors one after another on a shared
+/// @c TaskQueueThreadPool, which avoids a thread per wrapped object.
 ///
 /// A typical way of using this class is to have a member variable of a class
 /// wrapped by @c cu::Concurrent. In order to group several variables,
@@ -89,6 +91,27 @@ public:
   {
     return executor( std::bind(std::forward<F>(f),std::ref(item)) );
   }
+
+  /// Runs @c f(item) through the executor without creating a future.
+  ///
+  /// The executor must provide a member function @c post() like
+  /// @c cu::TaskQueueThread does. Exceptions escaping @c f are passed to
+  /// @c cu::handleException().
+  template <typename F>
+  void post( F && f )
+  {
+    executor.post( std::bind(std::forward<F>(f),std::ref(item)) );
+  }
+
+  /// Runs @c f(item) through the executor without creating a future.
+  ///
+  /// Same as the non-const variant, but a @c const item is bound as the
+  /// first argument to the functor that is dispatched by the executor.
+  template <typename F>
+  void post( F && f ) const
+  {
+    executor.post( std::bind(std::forward<F>(f),std::ref(item)) );
+  }
 };
 
 
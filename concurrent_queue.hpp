@@ -7,8 +7,13 @@
 #include "c++17_features.hpp"
 #include "monitor.hpp"
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <condition_variable>
+#include <initializer_list>
+#include <iterator>
+#include <limits>
 #include <list>
 #include <type_traits>
 
@@ -21,11 +26,24 @@ namespace cu
 /// and @c emplace(). Elements can be retrieved by the blocking member
 /// function @c pop().
 ///
+/// Bursts of elements should be added with @c pushRange() or
+/// @c emplaceMany() and drained with @c popAll() or @c popUpTo(). These
+/// functions lock the mutex only once per batch and wake up waiting
+/// consumers with a single notification.
+///
 /// The implementation supports arbitrary numbers of consumer and
 /// producer threads and should scale very well, since mutexes are
 /// only locked for very short times.
 ///
-/// The type @c T must be movable (or copyable) for the class to work.
+/// The queue is unbounded. List nodes of popped elements are not freed,
+/// but kept in a free list of the queue and reused by subsequent pushes.
+/// Hence, in steady state the queue does not allocate any memory.
+/// The number of cached nodes never exceeds the maximum number of elements
+/// that have been in the queue at the same time. The functions
+/// @c nodeAllocationCount() and @c cachedNodeCount() can be used to
+/// verify the allocation behavior.
+///
+/// The type @c T must be nothrow move constructible for the class to work.
 template <typename T>
 class ConcurrentQueue
 {
@@ -48,20 +66,62 @@ public:
 
   /// Emplaces an item into the queue, i. e. constructor arguments are forwarded.
   ///
+  /// The item is constructed before the mutex is locked and moved into
+  /// a recycled node under the lock.
+  ///
   /// This function provides the strong exception guarantee.
   template <typename ...Args>
   void emplace( Args &&... args )
   {
-    std::list<T> l;
-    l.emplace_back( std::forward<Args>(args)... );
-    data( [&l]( Data & data )
+    T item( std::forward<Args>(args)... );
+    data( [&]( Data & data )
     {
+      if ( data.freeNodes.empty() )
+      {
+        data.items.emplace_back(); // may throw.
+        ++nNodeAllocations;
+      }
+      else
+        data.items.splice( data.items.end(), data.freeNodes, data.freeNodes.begin() );
       // commit
-      data.items.splice( data.items.end(), std::move(l) );
+      data.items.back().emplace( std::move(item) );
       data.condition.notify_one(); // does not throw.
     });
   }
 
+  /// Copies or moves the items in the range [first,last) into the queue.
+  ///
+  /// The mutex is locked only once for the whole range, apart from
+  /// fetching recycled nodes beforehand. For single pass input iterators
+  /// the length of the range is unknown. Then recycled nodes are fetched
+  /// in chunks of growing size while the range is traversed.
+  /// Use @c std::make_move_iterator() in order to move the items.
+  ///
+  /// This function provides the strong exception guarantee.
+  template <typename InputIt>
+  void pushRange( InputIt first, InputIt last )
+  {
+    pushRangeImpl( first, last,
+                   typename std::iterator_traits<InputIt>::iterator_category{} );
+  }
+
+  /// Emplaces one item per argument into the queue.
+  ///
+  /// Each argument is forwarded to the constructor of one item.
+  /// The mutex is locked only once for all items, apart from
+  /// fetching recycled nodes beforehand.
+  ///
+  /// This function provides the strong exception guarantee.
+  template <typename ...Args>
+  void emplaceMany( Args &&... args )
+  {
+    auto l = takeFreeNodes( sizeof...(Args) );
+    auto nodeIt = l.begin();
+    (void)std::initializer_list<int>{
+      ( nodeIt = constructInNode( l, nodeIt, std::forward<Args>(args) ), 0 )... };
+    spliceIn( std::move(l) );
+  }
+
   /// Pops an item from the queue and returns it.
   ///
   /// If there's no item in the queue, then the function will block until there
@@ -75,15 +135,67 @@ public:
     static_assert( std::is_nothrow_move_constructible<T>::value,
                    "The item type should be move constructible in order to "
                    "provide the strong exception guarantee." );
-    std::list<T> l;
-    data( PassUniqueLockTag(), [&l]( Data & data, std::unique_lock<std::mutex> & lock )
+    return data( PassUniqueLockTag(), []( Data & data, std::unique_lock<std::mutex> & lock )
     {
-      data.condition.wait( lock, [&](){ return !data.items.empty(); } );
-      l.splice( l.end(), data.items, data.items.begin() );
+      data.waitForItems( lock );
+      return data.popFront();
     });
+  }
 
-    assert( !l.empty() );
-    return std::move( l.front() );
+  /// Pops at most @c maxCount items from the queue and writes them to @c out.
+  ///
+  /// If there's no item in the queue, then the function will block until there
+  /// is one. The items are moved to @c out after the mutex has been unlocked.
+  /// Afterwards the mutex is locked once more in order to recycle the nodes.
+  ///
+  /// @returns the number of popped items, which is at least one, if
+  /// @c maxCount is positive.
+  template <typename OutputIt>
+  std::size_t popUpTo( std::size_t maxCount, OutputIt out )
+  {
+    static_assert( std::is_nothrow_move_constructible<T>::value,
+                   "The item type should be move constructible in order to "
+                   "provide the strong exception guarantee." );
+    std::list<optional<T>> l;
+    if ( maxCount == 0 )
+      return 0;
+    data( PassUniqueLockTag(), [&]( Data & data, std::unique_lock<std::mutex> & lock )
+    {
+      data.waitForItems( lock );
+      if ( data.items.size() <= maxCount )
+      {
+        l.swap( data.items );
+        return;
+      }
+      auto last = data.items.begin();
+      std::advance( last, maxCount );
+      l.splice( l.end(), data.items, data.items.begin(), last );
+    });
+
+    const auto count = l.size();
+    for ( auto & item : l )
+    {
+      *out = std::move( *item );
+      ++out;
+      item = nullopt;
+    }
+    data( [&]( Data & data )
+    {
+      data.freeNodes.splice( data.freeNodes.begin(), l );
+    });
+    return count;
+  }
+
+  /// Pops all items from the queue and writes them to @c out.
+  ///
+  /// If there's no item in the queue, then the function will block until there
+  /// is one.
+  ///
+  /// @returns the number of popped items.
+  template <typename OutputIt>
+  std::size_t popAll( OutputIt out )
+  {
+    return popUpTo( std::numeric_limits<std::size_t>::max(), out );
   }
 
   /// Pops an item off the queue, blocking for at most @c maxWaitDuration.
@@ -99,19 +211,13 @@ public:
     static_assert( std::is_nothrow_move_constructible<T>::value,
                    "The item type should be move constructible in order to "
                    "provide the strong exception guarantee." );
-    std::list<T> l;
-    data( PassUniqueLockTag(), [&]( Data & data, std::unique_lock<std::mutex> & lock )
+    return data( PassUniqueLockTag(), [&]( Data & data, std::unique_lock<std::mutex> & lock )
+      -> optional<T>
     {
-      const auto success = data.condition.wait_for(
-            lock, maxWaitDuration, [&](){ return !data.items.empty(); } );
-      if ( success )
-        l.splice( l.end(), data.items, data.items.begin() );
+      if ( !data.waitForItems( lock, maxWaitDuration ) )
+        return nullopt;
+      return data.popFront();
     });
-
-    if ( l.empty() )
-      return nullopt;
-
-    return std::move( l.front() );
   }
 
   /// Returns the front item in the queue, if it is non-empty.
@@ -133,14 +239,154 @@ public:
     } );
   }
 
+  /// Returns the number of list nodes that have been allocated so far.
+  ///
+  /// In steady state this number does not grow anymore.
+  std::size_t nodeAllocationCount() const noexcept
+  {
+    return nNodeAllocations.load( std::memory_order_relaxed );
+  }
+
+  /// Returns the number of nodes which are currently kept for reuse.
+  std::size_t cachedNodeCount() const
+  {
+    return data( []( const Data & data ){ return data.freeNodes.size(); } );
+  }
+
 private:
+  using Nodes = std::list<optional<T>>;
+
+  /// Returns up to @c n empty nodes from the free list.
+  Nodes takeFreeNodes( std::size_t n )
+  {
+    Nodes l;
+    if ( n == 0 )
+      return l;
+    data( [&]( Data & data )
+    {
+      auto last = data.freeNodes.begin();
+      for ( std::size_t i = 0; i < n && last != data.freeNodes.end(); ++i )
+        ++last;
+      l.splice( l.end(), data.freeNodes, data.freeNodes.begin(), last );
+    });
+    return l;
+  }
+
+  /// Constructs an item in the node @c nodeIt, allocating a new node, if
+  /// @c nodeIt is past the end.
+  ///
+  /// @returns the iterator to the next node.
+  template <typename Arg>
+  typename Nodes::iterator constructInNode(
+      Nodes & l, typename Nodes::iterator nodeIt, Arg && arg )
+  {
+    if ( nodeIt == l.end() )
+    {
+      l.emplace_back( T( std::forward<Arg>(arg) ) );
+      ++nNodeAllocations;
+      return l.end();
+    }
+    nodeIt->emplace( std::forward<Arg>(arg) );
+    return std::next( nodeIt );
+  }
+
+  template <typename ForwardIt>
+  void pushRangeImpl( ForwardIt first, ForwardIt last, std::forward_iterator_tag )
+  {
+    auto l = takeFreeNodes(
+          static_cast<std::size_t>( std::distance( first, last ) ) );
+    auto nodeIt = l.begin();
+    for ( ; first != last; ++first )
+      nodeIt = constructInNode( l, nodeIt, *first );
+    spliceIn( std::move(l) );
+  }
+
+  template <typename InputIt>
+  void pushRangeImpl( InputIt first, InputIt last, std::input_iterator_tag )
+  {
+    Nodes l;
+    auto nodeIt = l.end();
+    std::size_t chunkSize = 1;
+    bool hasFreeNodes = true;
+    for ( ; first != last; ++first )
+    {
+      if ( nodeIt == l.end() && hasFreeNodes )
+      {
+        auto chunk = takeFreeNodes( chunkSize );
+        hasFreeNodes = chunk.size() == chunkSize;
+        chunkSize *= 2;
+        if ( !chunk.empty() )
+        {
+          nodeIt = chunk.begin();
+          l.splice( l.end(), chunk );
+        }
+      }
+      nodeIt = constructInNode( l, nodeIt, *first );
+    }
+    spliceIn( std::move(l) );
+  }
+
+  /// Appends the nodes of @c l which contain items and recycles the rest.
+  void spliceIn( Nodes l )
+  {
+    auto firstEmpty = std::find_if( l.begin(), l.end(),
+      []( const optional<T> & item ){ return !item; } );
+    const auto nItems = static_cast<std::size_t>(
+          std::distance( l.begin(), firstEmpty ) );
+    data( [&]( Data & data )
+    {
+      data.freeNodes.splice( data.freeNodes.begin(), l, firstEmpty, l.end() );
+      if ( nItems == 0 )
+        return;
+      // commit
+      data.items.splice( data.items.end(), std::move(l) );
+      // Waking more consumers than items would only make them contend
+      // for the lock and sleep again. Does not throw.
+      for ( auto n = std::min( nItems, data.nWaiters ); n != 0; --n )
+        data.condition.notify_one();
+    });
+  }
+
   struct Data
   {
-    std::list<T> items;
+    Nodes items;
+    Nodes freeNodes;
     std::condition_variable condition;
+    /// The number of consumers blocking on @c condition.
+    std::size_t nWaiters = 0;
+
+    void waitForItems( std::unique_lock<std::mutex> & lock )
+    {
+      ++nWaiters;
+      condition.wait( lock, [this](){ return !items.empty(); } );
+      --nWaiters;
+    }
+
+    template <typename Rep,
+              typename Period>
+    bool waitForItems( std::unique_lock<std::mutex> & lock,
+                       const std::chrono::duration<Rep, Period> & maxWaitDuration )
+    {
+      ++nWaiters;
+      const auto success = condition.wait_for(
+            lock, maxWaitDuration, [this](){ return !items.empty(); } );
+      --nWaiters;
+      return success;
+    }
+
+    /// Moves the front item out and puts its node into the free list.
+    T popFront() noexcept
+    {
+      assert( !items.empty() );
+      T result( std::move( *items.front() ) );
+      items.front() = nullopt;
+      freeNodes.splice( freeNodes.begin(), items, items.begin() );
+      return result;
+    }
   };
 
   Monitor<Data> data;
+  std::atomic<std::size_t> nNodeAllocations{0};
 };
 
 }
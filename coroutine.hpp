@@ -0,0 +1,165 @@
+/** @file Defines awaitables which let C++20 coroutines run on executors
+ * like @c TaskQueueThreadPool and @c TaskQueueThread.
+ *
+ * The contents of this file are only available, if the compiler supports
+ * coroutines. In this case the macro @c CU_HAS_COROUTINES is defined.
+ *
+ * @author Ralph Tandetzky
+ */
+
+#pragma once
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+#define CU_HAS_COROUTINES 1
+
+#include "c++17_features.hpp"
+
+#include <coroutine>
+#include <exception>
+#include <type_traits>
+#include <utility>
+
+namespace cu
+{
+
+namespace detail
+{
+  /// Resumes the awaiting coroutine in a task of the executor.
+  template <typename Executor>
+  class ScheduleAwaiter
+  {
+  public:
+    explicit ScheduleAwaiter( Executor & executor_ ) noexcept
+      : executor( executor_ )
+    {}
+
+    bool await_ready() const noexcept
+    {
+      return false;
+    }
+
+    void await_suspend( std::coroutine_handle<> coroutine )
+    {
+      executor.post( [coroutine]( auto &&... ){ coroutine.resume(); } );
+    }
+
+    void await_resume() const noexcept
+    {}
+
+  private:
+    Executor & executor;
+  };
+
+  /// Runs a functor in a task of the executor and resumes the awaiting
+  /// coroutine in the same task with the result.
+  ///
+  /// The result is stored in the awaiter, which lives in the coroutine
+  /// frame. The posted task only holds a pointer to the awaiter. Hence,
+  /// neither a packaged task nor a shared state is allocated.
+  template <typename Executor,
+            typename F,
+            typename ...Args>
+  class RunAwaiter
+  {
+  public:
+    using Result = std::invoke_result_t<F&, Args&...>;
+
+    RunAwaiter( Executor & executor_, F f_ )
+      : executor( executor_ )
+      , f( std::move(f_) )
+    {}
+
+    bool await_ready() const noexcept
+    {
+      return false;
+    }
+
+    void await_suspend( std::coroutine_handle<> coroutine_ )
+    {
+      coroutine = coroutine_;
+      executor.post( [this]( Args &... args )
+      {
+        run( args... );
+        coroutine.resume();
+      } );
+    }
+
+    Result await_resume()
+    {
+      if ( exception )
+        std::rethrow_exception( exception );
+      if constexpr ( !std::is_void_v<Result> )
+        return std::move( *result );
+    }
+
+  private:
+    struct NoResult {};
+
+    void run( Args &... args ) noexcept
+    {
+      try
+      {
+        if constexpr ( std::is_void_v<Result> )
+          f( args... );
+        else
+          result.emplace( f( args... ) );
+      }
+      catch ( ... )
+      {
+        exception = std::current_exception();
+      }
+    }
+
+    Executor & executor;
+    F f;
+    std::coroutine_handle<> coroutine;
+    optional<std::conditional_t<std::is_void_v<Result>, NoResult, Result>> result;
+    std::exception_ptr exception;
+  };
+} // namespace detail
+
+
+/// Returns an awaitable which resumes the awaiting coroutine in a task of
+/// @c executor.
+///
+/// The @c executor must provide a @c post() member function. Arguments
+/// passed by the executor to its tasks are ignored.
+///
+/// @example Moving the rest of a coroutine to a thread pool:
+///   @code
+///     cu::Future<Reply> handle( Request request )
+///     {
+///       co_await cu::schedule( pool );
+///       // runs on a worker of the pool now
+///       co_return process( request );
+///     }
+///   @endcode
+template <typename Executor>
+auto schedule( Executor & executor ) noexcept
+{
+  return detail::ScheduleAwaiter<Executor>( executor );
+}
+
+/// Returns an awaitable which calls @c f in a task of @c executor.
+///
+/// The awaiting coroutine is resumed in the same task. The result of
+/// @c f is the result of the @c co_await expression. Exceptions escaping
+/// @c f are rethrown there.
+///
+/// If the executor passes arguments to its tasks, like
+/// @c TaskQueueThreadPool<WorkerData...> does, then their types must be
+/// given as explicit template arguments @c Args and they are passed on to
+/// @c f.
+template <typename ...Args,
+          typename Executor,
+          typename F>
+auto schedule( Executor & executor, F && f )
+{
+  return detail::RunAwaiter<Executor, std::decay_t<F>, Args...>(
+        executor, std::forward<F>(f) );
+}
+
+} // namespace cu
+
+#endif
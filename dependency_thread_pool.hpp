@@ -1,23 +1,166 @@
 #pragma once
 
+#include "c++17_features.hpp"
+#include "exception_handling.hpp"
+#include "functors.hpp"
+#include "monitor.hpp"
 #include "scope_guard.hpp"
 #include "slice.hpp"
+#include "task_graph.hpp"
 #include "task_queue_thread_pool.hpp"
+#include "tracing.hpp"
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <cstdint>
 #include <future>
-#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <tuple>
 #include <type_traits>
-#include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace cu
 {
 
+namespace detail
+{
+  /// A table of nodes addressed by indices, which recycles freed nodes.
+  ///
+  /// The nodes are allocated in blocks of doubling size and never move.
+  /// Hence, references to nodes stay valid and lookups need no lock.
+  /// Freed indices are kept on a lock-free stack and handed out again by
+  /// @c allocate(). A node is not reset, when it is recycled.
+  template <typename Node>
+  class PooledNodeTable
+  {
+  public:
+    using Index = std::uint32_t;
+
+    PooledNodeTable() = default;
+    PooledNodeTable( const PooledNodeTable & ) = delete;
+    PooledNodeTable & operator=( const PooledNodeTable & ) = delete;
+
+    ~PooledNodeTable()
+    {
+      for ( auto & block : blocks )
+        delete[] block.load( std::memory_order_relaxed );
+    }
+
+    /// Returns the node with the given index.
+    ///
+    /// The index must have been returned by @c allocate() before.
+    Node & operator[]( Index index )
+    {
+      const auto location = locate( index );
+      return blocks[location.first].load( std::memory_order_acquire )
+          [location.second].node;
+    }
+
+    /// Tells whether @c index has ever been returned by @c allocate().
+    bool contains( std::uint64_t index ) const noexcept
+    {
+      return index < nAllocated.load( std::memory_order_acquire ) &&
+          blocks[locate( Index(index) ).first].load( std::memory_order_acquire );
+    }
+
+    /// Returns the index of a free node.
+    Index allocate()
+    {
+      auto head = freeHead.load( std::memory_order_acquire );
+      while ( const auto top = static_cast<Index>( head ) )
+      {
+        const auto index = top - 1;
+        const auto next = slot( index ).nextFree.load( std::memory_order_relaxed );
+        // The tag in the upper half prevents the ABA problem.
+        if ( freeHead.compare_exchange_weak(
+               head, ( ( (head >> 32) + 1 ) << 32 ) | next,
+               std::memory_order_acquire, std::memory_order_acquire ) )
+          return index;
+      }
+
+      const auto index = nAllocated.fetch_add( 1, std::memory_order_relaxed );
+      if ( index >= capacity )
+      {
+        nAllocated.fetch_sub( 1, std::memory_order_relaxed );
+        throw std::length_error( "Too many pending nodes." );
+      }
+      reserveBlock( locate( index ).first );
+      return index;
+    }
+
+    /// Makes the node with the given index available to @c allocate().
+    void free( Index index ) noexcept
+    {
+      auto & nextFree = slot( index ).nextFree;
+      auto head = freeHead.load( std::memory_order_relaxed );
+      do
+        nextFree.store( static_cast<Index>( head ), std::memory_order_relaxed );
+      while ( !freeHead.compare_exchange_weak(
+                head, ( ( (head >> 32) + 1 ) << 32 ) | ( index + 1 ),
+                std::memory_order_release, std::memory_order_relaxed ) );
+    }
+
+  private:
+    struct Slot
+    {
+      Node node;
+      /// One plus the index of the next free slot, or zero.
+      std::atomic<Index> nextFree{0};
+    };
+
+    static constexpr std::size_t firstBlockSize = 64;
+    static constexpr std::size_t nBlocks = 26;
+    static constexpr Index capacity =
+        Index( firstBlockSize * ( ( std::uint64_t{1} << nBlocks ) - 1 ) );
+
+    /// Returns the block and the offset in the block of an index.
+    ///
+    /// Block @c k holds the indices from @c firstBlockSize*(2^k-1) up to
+    /// @c firstBlockSize*(2^(k+1)-1).
+    static std::pair<std::size_t,std::size_t> locate( Index index ) noexcept
+    {
+      std::size_t k = 0;
+      for ( auto q = index / firstBlockSize + 1; q > 1; q >>= 1 )
+        ++k;
+      return { k, index - firstBlockSize * ( ( std::size_t{1} << k ) - 1 ) };
+    }
+
+    Slot & slot( Index index )
+    {
+      const auto location = locate( index );
+      return blocks[location.first].load( std::memory_order_acquire )
+          [location.second];
+    }
+
+    void reserveBlock( std::size_t k )
+    {
+      if ( blocks[k].load( std::memory_order_acquire ) )
+        return;
+      std::lock_guard<std::mutex> lock( growMutex );
+      if ( !blocks[k].load( std::memory_order_relaxed ) )
+        blocks[k].store( new Slot[firstBlockSize << k],
+                         std::memory_order_release );
+    }
+
+    std::array<std::atomic<Slot*>, nBlocks> blocks{};
+    std::mutex growMutex;
+    std::atomic<Index> nAllocated{0};
+    /// A tag in the upper half and one plus the index of the top of the
+    /// free stack in the lower half.
+    std::atomic<std::uint64_t> freeHead{0};
+  };
+} // namespace detail
+
+
 class DependencyThreadPoolBase
 {
 public:
-  using Id = std::size_t;
+  using Id = std::uint64_t;
   static constexpr const Id invalidId = ~static_cast<Id>(0);
 
   template <typename T>
@@ -33,6 +176,73 @@ public:
     std::future<T> future;
     Id id = invalidId;
   };
+
+  /// The exception, which the future of a cancelled task holds.
+  class TaskCancelled
+      : public std::runtime_error
+  {
+  public:
+    TaskCancelled()
+      : std::runtime_error( "The task has been cancelled." )
+    {}
+  };
+
+  /// Tells a running task, whether it has been cancelled.
+  ///
+  /// A token must only be used while the task it belongs to is running.
+  class CancellationToken
+  {
+  public:
+    /// Constructs a token which is never cancelled.
+    CancellationToken() = default;
+
+    bool isCancelled() const noexcept
+    {
+      return flag && flag->load( std::memory_order_relaxed );
+    }
+
+  private:
+    friend class DependencyThreadPoolBase;
+
+    explicit CancellationToken( const std::atomic<bool> * flag_ ) noexcept
+      : flag( flag_ )
+    {}
+
+    const std::atomic<bool> * flag = nullptr;
+  };
+
+  /// Returns the cancellation token of the task, which is running on the
+  /// current thread.
+  ///
+  /// Long running tasks can poll the token and return early, since their
+  /// result will be discarded anyways.
+  /// If the current thread does not run a task of a @c DependencyThreadPool,
+  /// then a token is returned, which is never cancelled.
+  ///
+  /// @example
+  ///   @code
+  ///     pool( { inputId }, [&]
+  ///     {
+  ///       const auto token = pool.cancellationToken();
+  ///       for ( auto & chunk : chunks )
+  ///       {
+  ///         if ( token.isCancelled() )
+  ///           return;
+  ///         process( chunk );
+  ///       }
+  ///     } );
+  ///   @endcode
+  static CancellationToken cancellationToken() noexcept
+  {
+    return CancellationToken( currentCancellationFlag() );
+  }
+
+protected:
+  static const std::atomic<bool> *& currentCancellationFlag() noexcept
+  {
+    static thread_local const std::atomic<bool> * result = nullptr;
+    return result;
+  }
 };
 
 
@@ -45,6 +255,27 @@ public:
 /// The returned id can be used as dependency for other subsequent tasks.
 /// Therefore cyclic dependencies are impossible by design.
 ///
+/// Each pending task has an atomic counter of open dependencies and a list
+/// of dependent tasks which is guarded by a mutex of its own. There is no
+/// global lock. The tasks live in a pooled table, so the nodes of finished
+/// tasks are reused without allocations. A task id consists of the index of
+/// its node and a generation counter which is incremented, when the task
+/// finishes. Hence, ids of finished tasks never refer to reused nodes.
+///
+/// If a task throws or is cancelled by @c cancel(), then all tasks which
+/// depend on it directly or indirectly are cancelled. A cancelled task is
+/// not executed, if it has not been started yet, and its future receives a
+/// @c TaskCancelled exception. Every dependency edge is visited only once,
+/// so the costs are linear in the number of edges. A running task can poll
+/// for cancellation with @c cancellationToken(). Note that a task is not
+/// cancelled by a dependency, which had already finished, when the task was
+/// added.
+///
+/// Tasks added by @c compute() keep their results in their nodes and pass
+/// them on to dependent tasks as arguments. This avoids the allocation of a
+/// shared state per edge, which a @c std::future would require. The node is
+/// recycled, when the last @c Output handle to the result is destroyed.
+///
 /// The template type arguments are the arguments that will be passed to the
 /// tasks and are data elements of the threadpool just as in
 /// @c TaskQueueThreadPool.
@@ -66,101 +297,538 @@ public:
       const cu::Slice<const Id> dependencyIds,
       F && f )
   {
-#if !defined(_MSC_VER)
-    auto pt = std::packaged_task<std::result_of_t<F(Args...)>(Args&&...)>(
-          std::forward<F>(f) );
-#else
-    // This is a work-around, since MSVC is not standard compliant.
-    // MSVC does not allow move-only functors to be passed to a
-    // packaged_task constructor except the move constructor.
-    auto fPtr = std::make_shared<F>( std::forward<F>(f) );
-    auto pt = std::packaged_task<std::result_of_t<F(Args...)>(Args&&...)>(
-          [fPtr]( Args &&... args ){ return (*fPtr)( std::forward<Args>(args)... ); } );
-#endif
-    auto future = pt.get_future();
-    cu::MoveFunction<void(Args&&...)> task = std::move(pt);
-    const auto id = data( [&]( Data & data )
-    {
-      const auto id = data.idCounter;
-      ++data.idCounter;
-      const auto nDependencies = data.updateDependencies( dependencyIds, id );
-      data.nodes.insert(
-        std::make_pair( id, Node{ nDependencies, {}, std::move(task) } ) );
-      if ( nDependencies == 0 )
-        queueTask( id, data.nodes );
-      return id;
-    } );
+    const auto traceId = detail::newTraceTaskId();
+    const auto index = allocateNode( 1 );
+    auto & node = nodes[index];
+    std::future<std::result_of_t<F(Args...)>> future;
+    try
+    {
+      auto pt = makeTask( node, traceId, std::forward<F>(f) );
+      future = pt.get_future();
+      node.task = std::move(pt);
+    }
+    catch ( ... )
+    {
+      nodes.free( index );
+      throw;
+    }
+    // If this throws, then the future receives a broken_promise error.
+    const auto id = schedule( index, traceId, dependencyIds );
     return { std::move(future), id };
   }
 
-private:
-  struct Node
+  /// A handle to the result of a task, which has been added by
+  /// @c compute().
+  ///
+  /// The result is kept in the node of the task, until the last handle to
+  /// it is destroyed. Handles must not outlive the pool.
+  template <typename T>
+  class Output
   {
-    Node(
-        std::size_t nOpenDependencies_,
-        std::vector<Id> dependentTasks_,
-        cu::MoveFunction<void(Args&&...)> task_ )
-      : nOpenDependencies( nOpenDependencies_ )
-      , dependentTasks( std::move( dependentTasks_ ) )
-      , task( std::move( task_ ) )
+  public:
+    Output() = default;
+
+    Output( const Output & other ) noexcept
+      : pool( other.pool )
+      , id_( other.id_ )
+    {
+      if ( pool )
+        pool->nodes[index()].nReferences.fetch_add(
+            handleReferences, std::memory_order_relaxed );
+    }
+
+    Output( Output && other ) noexcept
+      : pool( std::exchange( other.pool, nullptr ) )
+      , id_( other.id_ )
     {}
 
-    std::size_t nOpenDependencies;
-    std::vector<Id> dependentTasks;
-    cu::MoveFunction<void(Args&&...)> task;
+    Output & operator=( Output other ) noexcept
+    {
+      std::swap( pool, other.pool );
+      std::swap( id_, other.id_ );
+      return *this;
+    }
+
+    ~Output()
+    {
+      if ( pool )
+        pool->unref( index(), handleReferences );
+    }
+
+    /// Returns the id of the task, which can be used as dependency id.
+    Id id() const noexcept
+    {
+      return id_;
+    }
+
+  private:
+    friend class DependencyThreadPool;
+
+    Output( DependencyThreadPool * pool_, Id id )
+      : pool( pool_ )
+      , id_( id )
+    {}
+
+    std::uint32_t index() const noexcept
+    {
+      return std::uint32_t( id_ & 0xFFFFFFFF );
+    }
+
+    /// Returns the result or @c nullptr, if the task has failed or has been
+    /// cancelled.
+    ///
+    /// Must only be called after the task has finished.
+    T * result() const noexcept
+    {
+      return static_cast<T*>( pool->nodes[index()].result );
+    }
+
+    /// Tells whether this is the only handle to the result.
+    bool isUnique() const noexcept
+    {
+      return pool->nodes[index()].nReferences.load( std::memory_order_acquire )
+          / handleReferences == 1;
+    }
+
+    DependencyThreadPool * pool = nullptr;
+    Id id_ = invalidId;
   };
 
-  struct Data
+private:
+  static constexpr std::uint32_t handleReferences = 2;
+
+  /// An input of a task added by @c compute(). If @c isMoved is true, then
+  /// the value is passed to the task by value, otherwise by const
+  /// reference.
+  template <typename T,
+            bool isMoved>
+  struct TaskInput
+  {
+    Output<T> output;
+  };
+
+  template <typename T>
+  static TaskInput<T,false> makeTaskInput( const Output<T> & output )
   {
-    Id idCounter = 0;
-    std::map<Id,Node> nodes;
+    return { output };
+  }
+
+  template <typename T>
+  static TaskInput<T,true> makeTaskInput( Output<T> && output )
+  {
+    return { std::move(output) };
+  }
+
+  template <typename T>
+  static const T & read( const TaskInput<T,false> & input )
+  {
+    const auto result = input.output.result();
+    // The input has failed before the task was added.
+    if ( !result )
+      throw TaskCancelled();
+    return *result;
+  }
 
-    std::size_t updateDependencies(
-        const cu::Slice<const Id>  dependencies,
-        Id id )
+  template <typename T>
+  static T read( TaskInput<T,true> & input )
+  {
+    const auto result = input.output.result();
+    if ( !result )
+      throw TaskCancelled();
+    if ( input.output.isUnique() )
+      return std::move(*result);
+    return copy( *result, std::is_copy_constructible<T>() );
+  }
+
+  template <typename T>
+  static T copy( const T & value, std::true_type )
+  {
+    return value;
+  }
+
+  template <typename T>
+  static T copy( const T &, std::false_type )
+  {
+    throw std::logic_error( "A result which cannot be copied has been "
+                            "passed by value while other handles to it exist." );
+  }
+
+  /// The type of the argument, that is passed to a task for an input.
+  template <typename Input>
+  using InputArg = decltype( read( std::declval<
+    decltype( makeTaskInput( std::declval<Input>() ) ) &>() ) );
+
+  template <typename F,
+            typename ...Inputs>
+  using ComputeResult = std::result_of_t<F(InputArg<Inputs>..., Args...)>;
+
+public:
+  /// Schedules a task, which receives the results of other tasks as
+  /// arguments.
+  ///
+  /// The task will be executed only after the tasks of all @c inputs have
+  /// been finished. Their results are passed to @c f straight from the nodes
+  /// where they are stored. An input given as lvalue is passed as const
+  /// reference. An input given as rvalue is passed by value. The value is
+  /// moved out of the node, if no other handle to it is left, and copied
+  /// otherwise. The arguments of the pool, if any, are passed after the
+  /// inputs.
+  ///
+  /// Exceptions escaping @c f are passed to @c cu::handleException() and
+  /// cancel the dependent tasks.
+  ///
+  /// @returns A handle to the result, which can be passed as input to other
+  /// tasks. Its id can be used as dependency id for tasks added by the
+  /// function call operator. The result can be retrieved by
+  /// @c getFuture().
+  ///
+  /// @example
+  ///   @code
+  ///     auto image   = pool.compute( []{ return loadImage(); } );
+  ///     auto blurred = pool.compute( []( const Image & image ){ return blur( image ); }, image );
+  ///     auto edges   = pool.compute( []( const Image & image ){ return findEdges( image ); }, image );
+  ///     auto merged  = pool.compute( []( Image blurred, const Image & edges )
+  ///         { return merge( std::move(blurred), edges ); }, std::move(blurred), edges );
+  ///     const auto result = pool.getFuture( std::move(merged) ).get();
+  ///   @endcode
+  template <typename F,
+            typename ...Inputs>
+  Output<ComputeResult<F, Inputs...>> compute( F && f, Inputs &&... inputs )
+  {
+    using R = ComputeResult<F, Inputs...>;
+    static_assert( !std::is_void<R>::value,
+                   "Use the function call operator for tasks without result." );
+    const std::array<Id, sizeof...(Inputs)> dependencyIds{{ inputs.id()... }};
+    const auto traceId = detail::newTraceTaskId();
+    // References for the task and for the returned handle.
+    const auto index = allocateNode( 1 + handleReferences );
+    auto & node = nodes[index];
+    try
     {
-      std::size_t nDependencies = 0;
-      for ( auto dep : dependencies )
+      node.task =
+          [&node,
+           f = detail::makeTracedTask(
+             "DependencyThreadPool", traceId, std::forward<F>(f) ),
+           taskInputs = std::make_tuple(
+             makeTaskInput( std::forward<Inputs>(inputs) )... ),
+           value = optional<R>()]
+          ( Args &&... args ) mutable
       {
-        const auto it = nodes.find( dep );
-        if ( it == nodes.end() )
-          continue;
-        it->second.dependentTasks.push_back( id );
-        ++nDependencies;
-      }
-      return nDependencies;
+        CU_SCOPE_EXIT
+        {
+          // Otherwise the inputs would live as long as the result.
+          taskInputs = decltype(taskInputs)();
+        };
+        if ( node.cancelled.load( std::memory_order_relaxed ) )
+          return;
+        try
+        {
+          value.emplace( cu::apply( [&]( auto &... input ) -> R
+          {
+            return f( read( input )..., std::forward<Args>(args)... );
+          }, taskInputs ) );
+          node.result = &*value;
+        }
+        catch ( ... )
+        {
+          node.cancelled.store( true, std::memory_order_relaxed );
+          handleException();
+        }
+      };
+    }
+    catch ( ... )
+    {
+      nodes.free( index );
+      throw;
     }
+    try
+    {
+      return { this, schedule( index, traceId, dependencyIds ) };
+    }
+    catch ( ... )
+    {
+      unref( index, handleReferences );
+      throw;
+    }
+  }
+
+  /// Returns a future for the result of a task added by @c compute().
+  ///
+  /// The result is moved into the future, if @c output is the last handle
+  /// to it, and copied otherwise.
+  template <typename T>
+  std::future<T> getFuture( Output<T> output )
+  {
+    const std::array<Id, 1> dependencyIds{{ output.id() }};
+    return (*this)( dependencyIds,
+      [input = TaskInput<T,true>{ std::move(output) }]( auto &&... ) mutable
+    {
+      return read( input );
+    } ).future;
+  }
+
+  /// Cancels the task with the given id and all tasks depending on it.
+  ///
+  /// If the task has not been started yet, then it will not be executed.
+  /// Otherwise it can find out about the cancellation by polling its
+  /// @c cancellationToken().
+  ///
+  /// @returns @c false, if the task has finished already.
+  bool cancel( Id id )
+  {
+    const auto index = id & 0xFFFFFFFF;
+    if ( !nodes.contains( index ) )
+      return false;
+    auto & node = nodes[Index(index)];
+    return node.links( [&]( Links & links )
+    {
+      if ( links.generation != std::uint32_t( id >> 32 ) )
+        return false;
+      node.cancelled.store( true, std::memory_order_relaxed );
+      return true;
+    } );
+  }
+
+  /// Starts a run of the tasks of @c graph on the workers of this pool.
+  ///
+  /// Unlike tasks added by the function call operator, the tasks of a
+  /// @c TaskGraph are scheduled without allocating ids, nodes or futures.
+  /// Since the whole graph is known in advance, the ready tasks can be run
+  /// in the order of their critical paths, see @c TaskGraphScheduling.
+  ///
+  /// @returns a handle to wait for the run.
+  typename TaskGraph<Args...>::Completion run( TaskGraph<Args...> & graph )
+  {
+    return graph.run( workers );
+  }
+
+  /// Blocks until @c future is ready.
+  ///
+  /// If this function is called by a task of this pool, then the worker
+  /// executes other ready tasks while waiting instead of sleeping.
+  /// See @c TaskQueueThreadPool::wait().
+  template <typename Future>
+  void wait( const Future & future )
+  {
+    workers.wait( future );
+  }
+
+  /// Waits for the @c future like @c wait() and returns its result.
+  ///
+  /// @example A task which waits for an intermediate result:
+  ///   @code
+  ///     auto part = pool( {}, []{ return computePart(); } );
+  ///     pool( {}, [&]{ return pool.get( part.future ) + 1; } );
+  ///   @endcode
+  template <typename Future>
+  decltype(auto) get( Future && future )
+  {
+    return workers.get( std::forward<Future>(future) );
+  }
+
+private:
+  struct Links
+  {
+    /// Is incremented, when the task finishes.
+    std::uint32_t generation = 0;
+    /// The indices of the nodes of the tasks which depend on this one.
+    /// The capacity is kept when the node is reused.
+    std::vector<std::uint32_t> dependentTasks;
+  };
+
+  struct Node
+  {
+    Monitor<Links> links;
+    std::atomic<std::size_t> nOpenDependencies{0};
+    /// Is set, if the task is cancelled or throws. Then the dependent
+    /// tasks are cancelled too, when the task finishes.
+    std::atomic<bool> cancelled{false};
+    /// One for the task until it has finished plus @c handleReferences for
+    /// each @c Output handle. The node is recycled, when this drops to zero.
+    std::atomic<std::uint32_t> nReferences{0};
+    /// Points to the result of a task added by @c compute(), which is
+    /// stored in the task functor.
+    void * result = nullptr;
+    /// Identifies the task in execution traces, see tracing.hpp. It is
+    /// written before the task is published by @c schedule() and read by
+    /// dependent tasks only while the generation of the links matches.
+    detail::TraceTaskId traceId;
+    cu::MoveFunction<void(Args&&...)> task;
   };
 
-  void queueTask( Id id, std::map<Id,Node> & nodes )
+  using Index = typename detail::PooledNodeTable<Node>::Index;
+
+  static Id makeId( Index index, std::uint32_t generation ) noexcept
+  {
+    return ( Id(generation) << 32 ) | index;
+  }
+
+  Index allocateNode( std::uint32_t nReferences )
+  {
+    const auto index = nodes.allocate();
+    auto & node = nodes[index];
+    node.cancelled.store( false, std::memory_order_relaxed );
+    node.nReferences.store( nReferences, std::memory_order_relaxed );
+    node.result = nullptr;
+    return index;
+  }
+
+  /// Registers the dependencies of the task in node @c index and queues it,
+  /// if there are no pending dependencies.
+  ///
+  /// @returns the id of the task.
+  Id schedule( Index index, detail::TraceTaskId traceId,
+               cu::Slice<const Id> dependencyIds )
+  {
+    auto & node = nodes[index];
+    // The extra count keeps the task from being started before all
+    // dependencies have been registered.
+    node.nOpenDependencies.store( 1, std::memory_order_relaxed );
+    node.traceId = traceId;
+    const auto generation = node.links( []( Links & links )
+    {
+      return links.generation;
+    } );
+    try
+    {
+      for ( auto dependencyId : dependencyIds )
+        addDependency( dependencyId, index, traceId );
+    }
+    catch ( ... )
+    {
+      node.task = nullptr;
+      release( index );
+      throw;
+    }
+    release( index );
+    return makeId( index, generation );
+  }
+
+  /// Wraps @c f into a packaged task, which is skipped, if the node has been
+  /// cancelled, and which cancels the node, if @c f throws.
+  template <typename F>
+  static auto makeTask( Node & node, detail::TraceTaskId traceId, F && f )
+  {
+    using R = std::result_of_t<F(Args...)>;
+    auto & cancelled = node.cancelled;
+    auto task = [&cancelled,
+                 f = detail::makeTracedTask(
+                   "DependencyThreadPool", traceId, std::forward<F>(f) )]
+        ( Args &&... args ) mutable -> R
+    {
+      if ( cancelled.load( std::memory_order_relaxed ) )
+        throw TaskCancelled();
+      try
+      {
+        return f( std::forward<Args>(args)... );
+      }
+      catch ( ... )
+      {
+        cancelled.store( true, std::memory_order_relaxed );
+        throw;
+      }
+    };
+#if !defined(_MSC_VER)
+    return std::packaged_task<R(Args&&...)>( std::move(task) );
+#else
+    // This is a work-around, since MSVC is not standard compliant.
+    // MSVC does not allow move-only functors to be passed to a
+    // packaged_task constructor except the move constructor.
+    auto taskPtr = std::make_shared<decltype(task)>( std::move(task) );
+    return std::packaged_task<R(Args&&...)>(
+          [taskPtr]( Args &&... args ){ return (*taskPtr)( std::forward<Args>(args)... ); } );
+#endif
+  }
+
+  /// Lets the task with node @c index wait for the task @c dependencyId,
+  /// if the latter is still pending.
+  void addDependency( Id dependencyId, Index index,
+                      detail::TraceTaskId traceId )
+  {
+    const auto dependencyIndex = dependencyId & 0xFFFFFFFF;
+    if ( !nodes.contains( dependencyIndex ) )
+      return;
+    auto & node = nodes[index];
+    nodes[Index(dependencyIndex)].links( [&]( Links & links )
+    {
+      if ( links.generation != std::uint32_t( dependencyId >> 32 ) )
+        return;
+      // The increment must happen under the lock. Otherwise the dependency
+      // might finish and decrement the counter before.
+      links.dependentTasks.push_back( index );
+      node.nOpenDependencies.fetch_add( 1, std::memory_order_relaxed );
+      detail::traceEdge( nodes[Index(dependencyIndex)].traceId, traceId );
+    } );
+  }
+
+  /// Decrements the number of open dependencies and queues the task, if it
+  /// was the last one.
+  void release( Index index )
+  {
+    auto & node = nodes[index];
+    if ( node.nOpenDependencies.fetch_sub( 1, std::memory_order_acq_rel ) == 1 )
+      queueTask( index );
+  }
+
+  /// Posts the task with node @c index to the workers. The task records
+  /// its own trace events, so the untraced path of the pool is used.
+  void queueTask( Index index )
   {
-    const auto nodeIt = nodes.find(id);
-    assert( nodeIt != nodes.end() );
-    assert( nodeIt->second.nOpenDependencies == 0 );
-    workers( [this, nodeIt]
-             ( Args &&... args ) mutable
+    detail::traceEnqueue( nodes[index].traceId );
+    workers.postUntraced( [this, index]( Args &&... args )
     {
+      auto & node = nodes[index];
+      auto & currentFlag = currentCancellationFlag();
+      const auto previousFlag = currentFlag;
+      currentFlag = &node.cancelled;
       CU_SCOPE_EXIT
       {
-        this->data( [&]( Data & data )
-        {
-          for ( auto dependentId : nodeIt->second.dependentTasks )
-          {
-            const auto dependentNodeIt = data.nodes.find( dependentId );
-            assert( dependentNodeIt != data.nodes.end() );
-            const auto nRemainingDependencies =
-                --dependentNodeIt->second.nOpenDependencies;
-            if ( nRemainingDependencies == 0 )
-              queueTask( dependentId, data.nodes );
-          }
-          data.nodes.erase( nodeIt );
-        } );
+        currentFlag = previousFlag;
+        finish( index );
       };
-      nodeIt->second.task( std::forward<Args>(args)... );
+      if ( node.task )
+        node.task( std::forward<Args>(args)... );
+    } );
+  }
+
+  /// Releases or cancels the dependent tasks and recycles the node, unless
+  /// there are handles to its result.
+  void finish( Index index )
+  {
+    auto & node = nodes[index];
+    auto cancelDependents = false;
+    // After the generation has been incremented, no dependent tasks are
+    // added and the task cannot be cancelled anymore. Hence, the list can
+    // be traversed without lock.
+    auto & dependentTasks = node.links( [&]( Links & links )
+      -> std::vector<std::uint32_t> &
+    {
+      ++links.generation;
+      cancelDependents = node.cancelled.load( std::memory_order_relaxed );
+      return links.dependentTasks;
     } );
+    for ( auto dependentIndex : dependentTasks )
+    {
+      if ( cancelDependents )
+        nodes[dependentIndex].cancelled.store( true, std::memory_order_relaxed );
+      release( dependentIndex );
+    }
+    dependentTasks.clear();
+    unref( index, 1 );
+  }
+
+  void unref( Index index, std::uint32_t nReferences ) noexcept
+  {
+    auto & node = nodes[index];
+    if ( node.nReferences.fetch_sub( nReferences, std::memory_order_acq_rel )
+         == nReferences )
+    {
+      node.task = nullptr;
+      nodes.free( index );
+    }
   }
 
-  cu::Monitor<Data> data;
+  detail::PooledNodeTable<Node> nodes;
   TaskQueueThreadPool<Args...> workers;
 };
 
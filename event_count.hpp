@@ -0,0 +1,176 @@
+/** @file Defines the class @c cu::EventCount.
+ * @author Ralph Tandetzky
+ */
+
+#pragma once
+
+#include "monitor.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <thread>
+
+#if defined(__linux__)
+#include <linux/membarrier.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace cu
+{
+
+namespace detail
+{
+#if defined(__linux__) && defined(SYS_membarrier)
+  /// Returns whether @c heavyFence() is implemented by @c membarrier().
+  ///
+  /// The first call registers the process for expedited membarriers.
+  inline bool hasProcessWideFence() noexcept
+  {
+    static const bool result = []
+    {
+      const auto commands = syscall( SYS_membarrier, MEMBARRIER_CMD_QUERY, 0 );
+      return commands >= 0 &&
+          ( commands & MEMBARRIER_CMD_PRIVATE_EXPEDITED ) &&
+          syscall( SYS_membarrier,
+                   MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0 ) == 0;
+    }();
+    return result;
+  }
+#else
+  inline bool hasProcessWideFence() noexcept
+  {
+    return false;
+  }
+#endif
+
+  /// Orders preceding stores before subsequent loads of the calling thread
+  /// with respect to a concurrent @c heavyFence() in another thread.
+  ///
+  /// This is only a compiler barrier, if @c heavyFence() is process-wide.
+  inline void lightFence() noexcept
+  {
+    if ( hasProcessWideFence() )
+      std::atomic_signal_fence( std::memory_order_seq_cst );
+    else
+      std::atomic_thread_fence( std::memory_order_seq_cst );
+  }
+
+  /// Executes a full memory fence, which pairs with @c lightFence().
+  ///
+  /// If possible, a memory barrier is executed on all running threads of
+  /// the process. This is expensive, so it should only be called on slow
+  /// paths.
+  inline void heavyFence() noexcept
+  {
+#if defined(__linux__) && defined(SYS_membarrier)
+    if ( hasProcessWideFence() )
+    {
+      syscall( SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0 );
+      return;
+    }
+#endif
+    std::atomic_thread_fence( std::memory_order_seq_cst );
+  }
+} // namespace detail
+
+/// A cheap way for threads to park until a condition becomes true.
+///
+/// This is the building block for the lock-free queues of this library.
+/// A waiting thread first spins for a short while and only parks on a
+/// condition variable, if its predicate still does not hold.
+/// Notifying is almost free as long as nobody is parked: The mutex is
+/// only locked, if there is a parked thread. On Linux, notifiers do not
+/// even execute a memory fence. Instead, a thread which is about to park
+/// executes a fence on all threads of the process with @c membarrier().
+///
+/// The predicate must become true by a modification of atomic state
+/// which happens before the corresponding call of @c notifyOne() or
+/// @c notifyAll(). The predicate may have side effects like popping an
+/// element off a queue. It is only called again, if it returned @c false.
+class EventCount
+{
+public:
+  /// Blocks until @c pred() returns @c true.
+  template <typename Pred>
+  void wait( Pred && pred )
+  {
+    if ( spin( pred ) )
+      return;
+
+    data( PassUniqueLockTag(), [&]( Data & data, std::unique_lock<std::mutex> & lock )
+    {
+      ++nWaiters;
+      detail::heavyFence();
+      data.condition.wait( lock, pred );
+      --nWaiters;
+    } );
+  }
+
+  /// Blocks until @c pred() returns @c true or the @c deadline has passed.
+  ///
+  /// @returns the last result of @c pred().
+  template <typename Pred,
+            typename Clock,
+            typename Duration>
+  bool waitUntil( Pred && pred,
+                  const std::chrono::time_point<Clock,Duration> & deadline )
+  {
+    if ( spin( pred ) )
+      return true;
+
+    return data( PassUniqueLockTag(), [&]( Data & data, std::unique_lock<std::mutex> & lock )
+    {
+      ++nWaiters;
+      detail::heavyFence();
+      const auto success = data.condition.wait_until( lock, deadline, pred );
+      --nWaiters;
+      return success;
+    } );
+  }
+
+  /// Wakes up one parked thread, if there is any.
+  void notifyOne()
+  {
+    detail::lightFence();
+    if ( nWaiters.load( std::memory_order_relaxed ) == 0 )
+      return;
+    data( []( Data & data ){ data.condition.notify_one(); } );
+  }
+
+  /// Wakes up all parked threads.
+  void notifyAll()
+  {
+    detail::lightFence();
+    if ( nWaiters.load( std::memory_order_relaxed ) == 0 )
+      return;
+    data( []( Data & data ){ data.condition.notify_all(); } );
+  }
+
+private:
+  static constexpr int nSpins = 64;
+
+  template <typename Pred>
+  static bool spin( Pred & pred )
+  {
+    for ( auto i = 0; i < nSpins; ++i )
+    {
+      if ( pred() )
+        return true;
+      if ( i >= nSpins/2 )
+        std::this_thread::yield();
+    }
+    return false;
+  }
+
+  struct Data
+  {
+    std::condition_variable condition;
+  };
+
+  std::atomic<std::size_t> nWaiters{0};
+  Monitor<Data> data;
+};
+
+} // namespace cu
@@ -2,6 +2,7 @@
 
 #include <cassert>
 #include <functional>
+#include <string>
 #include <exception>
 #include <vector>
 
@@ -1,10 +1,12 @@
 /** @file Defines miscellaneous general purpose functor types.
  * @author Ralph Tandetzky
  *
- * This header defines two generic functor classes which take a function
+ * This header defines three generic functor classes which take a function
  * signature as function argument:
  *  - Lambda<Result(Args...)>
  *  - MoveFunction<Result(Args...)> and MoveFunction<Result(Args...)const>
+ *  - InplaceFunction<Result(Args...),Capacity,Align> and
+ *    InplaceFunction<Result(Args...)const,Capacity,Align>
  * These can be passed as function argument types just like
  *  - std::function<Result(Args...)>
  *  - F && where F is a template parameter.
@@ -16,7 +18,8 @@
  *
  * C-function ptr      yes         yes        no
  * std::function       yes         yes        mostly
- * cu::MoveFunction    no          yes        at most once
+ * cu::MoveFunction    no          yes        only large functors
+ * cu::InplaceFunction no          yes        never
  * cu::Lambda          no          no         no
  * template            depends     depends    no
  *
@@ -30,13 +33,18 @@
  *    cu::Lambda with the same performance as the C function pointer.
  *  - Since cu::Lambda is neither movable nor copyable it can only be used
  *    locally. But for this purpose it is perfect: Flexible and super fast.
- *  - cu::MoveFunction and std::function require a heap allocation, if
- *    they are constructed from a stateful functor. This makes them a more
- *    expensive at construction.
+ *  - std::function requires a heap allocation, if it is constructed from a
+ *    stateful functor. This makes it more expensive at construction.
+ *    cu::MoveFunction stores functors of up to six pointers in size inline,
+ *    if they are nothrow movable. Only larger functors are allocated on
+ *    the heap.
  *  - cu::MoveFunction and std::function objects can can be stored in
  *    containers or data fields of classes. This is when they should be used.
  *  - If you require the functor to be copyable, then use std::function.
  *    Otherwise use cu::MoveFunction.
+ *  - If memory must never be allocated, e. g. in real-time code, then use
+ *    cu::InplaceFunction. Functors which do not fit into its buffer are
+ *    rejected at compile time.
  */
 
 #pragma once
@@ -44,8 +52,11 @@
 #include "functors_fwd.hpp"
 #include "swap.hpp"
 
+#include <cstddef>
 #include <functional>
 #include <memory>
+#include <new>
+#include <type_traits>
 #include <utility>
 
 namespace cu
@@ -146,13 +157,21 @@ auto makeOverloadedFunctor( Fs &&... fs )
 }
 
 
-template <bool, typename...>
+/// The common implementation of @c MoveFunction and @c InplaceFunction.
+///
+/// Functors are stored in an inline buffer of @c capacity bytes aligned
+/// to @c alignment, if they fit. Otherwise they are allocated on the heap,
+/// if @c allowsHeap is @c true. If not, the functor cannot be stored.
+template <bool, std::size_t, std::size_t, bool, typename...>
 class MoveFunctionBase;
 
 template <bool isCallOpConst,
+          std::size_t capacity,
+          std::size_t alignment,
+          bool allowsHeap,
           typename Res,
           typename ...Args>
-class MoveFunctionBase<isCallOpConst, Res(Args...)>
+class MoveFunctionBase<isCallOpConst, capacity, alignment, allowsHeap, Res(Args...)>
 {
   template <typename F>
   using FunctorType = std::conditional_t<isCallOpConst,
@@ -160,10 +179,25 @@ class MoveFunctionBase<isCallOpConst, Res(Args...)>
   using PayLoadType = FunctorType<void>;
 
 public:
+  static_assert( capacity > 0, "The inline capacity must be positive." );
+
+  using Storage = std::aligned_storage_t<capacity, alignment>;
+
+  /// Tells whether a functor of type @c F is stored in the inline buffer.
+  ///
+  /// This is the case, if it fits and if it can be moved without throwing.
+  /// Otherwise, it is allocated on the heap.
+  template <typename F>
+  struct IsStoredInline
+      : std::integral_constant<bool,
+          sizeof(std::decay_t<F>) <= capacity &&
+          alignof(Storage) % alignof(std::decay_t<F>) == 0 &&
+          std::is_nothrow_move_constructible<std::decay_t<F>>::value>
+  {};
+
   // constructors
 
   MoveFunctionBase() noexcept
-    : payLoad( nullptr, [](PayLoadType*){} )
   {}
 
   MoveFunctionBase( std::nullptr_t ) noexcept
@@ -175,26 +209,28 @@ public:
   MoveFunctionBase( const MoveFunctionBase && ) = delete;
 
   MoveFunctionBase( MoveFunctionBase && other ) noexcept
-    : MoveFunctionBase()
   {
-    swap( other );
+    moveFrom( other );
   }
 
-  template <typename F>
+  template <typename F,
+            typename = std::enable_if_t<
+              allowsHeap || IsStoredInline<F>::value>>
   MoveFunctionBase( F && f )
     : MoveFunctionBase(
         std::forward<F>(f),
         typename std::conditional_t<
-          std::is_empty<std::decay_t<F>>::value,
-          EmptyPayLoadTag,
-          typename std::conditional_t<
-            std::is_convertible<F,Res(*)(Args...)>::value,
-            FunctionPointerTag,
-            NonEmptyPayLoadTag
-          >
+          IsStoredInline<F>::value,
+          InlinePayLoadTag,
+          HeapPayLoadTag
         >{} )
   {}
 
+  ~MoveFunctionBase()
+  {
+    reset();
+  }
+
   // assignment and swap
 
   MoveFunctionBase & operator=( MoveFunctionBase other ) noexcept
@@ -205,8 +241,9 @@ public:
 
   void swap( MoveFunctionBase & other ) noexcept
   {
-    std::swap( callPtr, other.callPtr );
-    std::swap( payLoad, other.payLoad );
+    MoveFunctionBase tmp( std::move(other) );
+    other.moveFrom( *this );
+    moveFrom( tmp );
   }
 
   // operators
@@ -217,75 +254,125 @@ public:
   }
 
   Res (*callPtr)( PayLoadType *, Args&&... ) = nullptr;
-  std::unique_ptr<PayLoadType,void(*)(PayLoadType*)> payLoad;
+  /// Move constructs the functor from @c src into @c dst and destroys it in
+  /// @c src. If @c src is null, then the functor in @c dst is destroyed.
+  /// This pointer is null, if the functor is trivially copyable and
+  /// destructible and stored inline.
+  void (*managePtr)( Storage * dst, Storage * src ) = nullptr;
+  Storage storage;
 
 private:
-  struct EmptyPayLoadTag    {};
-  struct FunctionPointerTag {};
-  struct NonEmptyPayLoadTag {};
+  struct InlinePayLoadTag {};
+  struct HeapPayLoadTag   {};
+
+  /// Takes over the functor of @c other. @c *this must be empty.
+  void moveFrom( MoveFunctionBase & other ) noexcept
+  {
+    if ( other.managePtr )
+      other.managePtr( &storage, &other.storage );
+    else if ( other.callPtr )
+      storage = other.storage;
+    callPtr   = other.callPtr;
+    managePtr = other.managePtr;
+    other.callPtr   = nullptr;
+    other.managePtr = nullptr;
+  }
+
+  void reset() noexcept
+  {
+    if ( managePtr )
+      managePtr( &storage, nullptr );
+    callPtr   = nullptr;
+    managePtr = nullptr;
+  }
+
+  template <typename Functor>
+  static void manageInline( Storage * dst, Storage * src ) noexcept
+  {
+    if ( src )
+    {
+      auto & functor = *reinterpret_cast<Functor*>( src );
+      ::new( static_cast<void*>( dst ) ) Functor( std::move(functor) );
+      functor.~Functor();
+    }
+    else
+      reinterpret_cast<Functor*>( dst )->~Functor();
+  }
+
+  template <typename Functor>
+  static void manageHeap( Storage * dst, Storage * src ) noexcept
+  {
+    if ( src )
+      ::new( static_cast<void*>( dst ) ) Functor*(
+          *reinterpret_cast<Functor**>( src ) );
+    else
+      delete *reinterpret_cast<Functor**>( dst );
+  }
 
   template <typename F>
-  MoveFunctionBase( F && f, EmptyPayLoadTag )
+  MoveFunctionBase( F && f, InlinePayLoadTag )
     : callPtr
       {
-        []( PayLoadType * payLoad, Args&&...args )
+        []( PayLoadType * payLoad, Args&&...args ) -> Res
         {
           return (*static_cast<FunctorType<F>*>(payLoad))(
                 std::forward<Args>(args)...);
         }
       }
-    , payLoad{ &f, [](PayLoadType*){} }
-  {}
-
-  template <typename F>
-  MoveFunctionBase( F && f, FunctionPointerTag )
-    : callPtr
+    , managePtr
       {
-        []( PayLoadType * payLoad, Args&&...args )
-        {
-          return reinterpret_cast<Res(*)(Args...)>(payLoad)(
-                std::forward<Args>(args)...);
-        }
-      }
-    , payLoad{
-        reinterpret_cast<PayLoadType*>(static_cast<Res(*)(Args...)>(f)),
-        [](PayLoadType*){}
+        std::is_trivially_copyable<std::decay_t<F>>::value &&
+        std::is_trivially_destructible<std::decay_t<F>>::value
+        ? nullptr
+        : &manageInline<std::decay_t<F>>
       }
   {
-    static_assert( sizeof(Res(*)(Args...)) == sizeof(PayLoadType*), "" );
+    ::new( static_cast<void*>( &storage ) ) std::decay_t<F>( std::forward<F>(f) );
   }
 
   template <typename F>
-  MoveFunctionBase( F && f, NonEmptyPayLoadTag )
+  MoveFunctionBase( F && f, HeapPayLoadTag )
     : callPtr
       {
-        []( PayLoadType * payLoad, Args&&...args )
+        []( PayLoadType * payLoad, Args&&...args ) -> Res
         {
-          return (*static_cast<FunctorType<F>*>(payLoad))(
+          return (**static_cast<FunctorType<F>*const*>(payLoad))(
                 std::forward<Args>(args)... );
         }
       }
-    , payLoad{
-        new typename std::decay_t<F>( std::forward<F>(f) ),
-        []( PayLoadType * payLoad )
-        {
-          delete static_cast<FunctorType<F>*>(payLoad);
-        }
-      }
-  {}
+    , managePtr{ &manageHeap<std::decay_t<F>> }
+  {
+    ::new( static_cast<void*>( &storage ) ) std::decay_t<F>*(
+          new std::decay_t<F>( std::forward<F>(f) ) );
+  }
 };
 
 
+namespace detail
+{
+  /// The inline capacity of @c MoveFunction in bytes.
+  ///
+  /// Together with the two function pointers a @c MoveFunction occupies
+  /// exactly one cache line on 64-bit platforms.
+  constexpr std::size_t moveFunctionCapacity = 6*sizeof(void*);
+} // namespace detail
+
+
 /// This class mimics the behaviour of std::function, except that it
 /// does not require the assigned functors to be copyable, but to be
 /// movable only. Consequently, @c MoveFunction objects are
 /// MoveOnly as well.
+///
+/// Functors of up to six pointers in size which are nothrow movable are
+/// stored inline. Larger ones are allocated on the heap.
 template <typename Res,
           typename ...Args>
 class MoveFunction<Res(Args...)>
-    : private MoveFunctionBase<false, Res(Args...)>
+    : private MoveFunctionBase<false, detail::moveFunctionCapacity,
+                               alignof(void*), true, Res(Args...)>
 {
-  using Base = MoveFunctionBase<false, Res(Args...)>;
+  using Base = MoveFunctionBase<false, detail::moveFunctionCapacity,
+                                alignof(void*), true, Res(Args...)>;
 public:
   using Base::Base;
 
@@ -308,7 +395,7 @@ public:
   Res operator()( Args...args )
   {
     if ( *this )
-      return this->callPtr( this->payLoad.get(), std::forward<Args>(args)... );
+      return this->callPtr( &this->storage, std::forward<Args>(args)... );
     else
       throw std::bad_function_call{};
   }
@@ -318,9 +405,11 @@ public:
 template <typename Res,
           typename ...Args>
 class MoveFunction<Res(Args...) const>
-    : private MoveFunctionBase<true, Res(Args...)>
+    : private MoveFunctionBase<true, detail::moveFunctionCapacity,
+                               alignof(void*), true, Res(Args...)>
 {
-  using Base = MoveFunctionBase<true, Res(Args...)>;
+  using Base = MoveFunctionBase<true, detail::moveFunctionCapacity,
+                                alignof(void*), true, Res(Args...)>;
 public:
   using Base::Base;
 
@@ -343,7 +432,97 @@ public:
   Res operator()( Args...args ) const
   {
     if ( *this )
-      return this->callPtr( this->payLoad.get(), std::forward<Args>(args)... );
+      return this->callPtr( &this->storage, std::forward<Args>(args)... );
+    else
+      throw std::bad_function_call{};
+  }
+};
+
+
+/// A move-only function wrapper like @c MoveFunction which never allocates.
+///
+/// The wrapped functor is always stored in an inline buffer of @c capacity
+/// bytes with the given @c alignment. If a functor is too large,
+/// over-aligned or not nothrow move constructible, then the converting
+/// constructor does not take part in overload resolution, so the
+/// construction fails to compile. This guarantees that code
+/// paths which must not allocate memory, such as real-time audio threads or
+/// the lock-free queues of this library, can still store type-erased
+/// callbacks.
+///
+/// @example
+///   @code
+///     cu::InplaceFunction<void(float), 2*sizeof(void*)> callback =
+///         [this, &filter]( float x ){ filter( x ); };
+///   @endcode
+template <typename Res,
+          typename ...Args,
+          std::size_t capacity,
+          std::size_t alignment>
+class InplaceFunction<Res(Args...), capacity, alignment>
+    : private MoveFunctionBase<false, capacity, alignment, false, Res(Args...)>
+{
+  using Base = MoveFunctionBase<false, capacity, alignment, false, Res(Args...)>;
+public:
+  using Base::Base;
+
+  InplaceFunction() = default;
+  InplaceFunction( InplaceFunction && ) = default;
+
+  InplaceFunction & operator=( InplaceFunction other ) noexcept
+  {
+    swap( other );
+    return *this;
+  }
+
+  void swap( InplaceFunction & other ) noexcept
+  {
+    Base::swap( other );
+  }
+
+  using Base::operator bool;
+
+  Res operator()( Args...args )
+  {
+    if ( *this )
+      return this->callPtr( &this->storage, std::forward<Args>(args)... );
+    else
+      throw std::bad_function_call{};
+  }
+};
+
+
+template <typename Res,
+          typename ...Args,
+          std::size_t capacity,
+          std::size_t alignment>
+class InplaceFunction<Res(Args...) const, capacity, alignment>
+    : private MoveFunctionBase<true, capacity, alignment, false, Res(Args...)>
+{
+  using Base = MoveFunctionBase<true, capacity, alignment, false, Res(Args...)>;
+public:
+  using Base::Base;
+
+  InplaceFunction() = default;
+  InplaceFunction( InplaceFunction && ) = default;
+
+  InplaceFunction & operator=( InplaceFunction other ) noexcept
+  {
+    swap( other );
+    return *this;
+  }
+
+  void swap( InplaceFunction & other ) noexcept
+  {
+    Base::swap( other );
+  }
+
+  using Base::operator bool;
+
+  Res operator()( Args...args ) const
+  {
+    if ( *this )
+      return this->callPtr( &this->storage, std::forward<Args>(args)... );
     else
       throw std::bad_function_call{};
   }
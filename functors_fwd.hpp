@@ -1,4 +1,5 @@
-/** @file Forward declares the template classes @c Lambda and @c MoveFunction.
+/** @file Forward declares the template classes @c Lambda, @c MoveFunction
+ * and @c InplaceFunction.
  *
  * Prefer to include this header file rather than "functors.hpp" in
  * header files. This reduces compile-time dependecies.
@@ -8,6 +9,8 @@
 
 #pragma once
 
+#include <cstddef>
+
 namespace cu
 {
 
@@ -17,4 +20,9 @@ class Lambda;
 template <typename Signature>
 class MoveFunction;
 
+template <typename Signature,
+          std::size_t capacity = 4*sizeof(void*),
+          std::size_t alignment = alignof(std::max_align_t)>
+class InplaceFunction;
+
 } // namespace cu
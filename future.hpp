@@ -0,0 +1,664 @@
+/** @file Defines the classes @c cu::Future and @c cu::Promise which support
+ * continuations, and the functions @c cu::launch(), @c cu::whenAll() and
+ * @c cu::whenAny().
+ *
+ * If the compiler supports coroutines, then functions returning a
+ * @c cu::Future can be coroutines and futures can be awaited.
+ *
+ * @author Ralph Tandetzky
+ */
+
+#pragma once
+
+#include "c++17_features.hpp"
+#include "coroutine.hpp"
+#include "functors.hpp"
+#include "monitor.hpp"
+
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <exception>
+#include <future>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace cu
+{
+
+template <typename T>
+class Future;
+
+template <typename T>
+class Promise;
+
+namespace detail
+{
+  /// Stands in for the value of a @c Future<void>.
+  struct FutureVoidValue {};
+
+  template <typename T>
+  using FutureValue = std::conditional_t<
+    std::is_void<T>::value, FutureVoidValue, T>;
+
+  /// The state shared by a @c Promise and its @c Future.
+  ///
+  /// The continuation is called with the state as argument after the
+  /// result has been set. It is called on the thread which sets the result
+  /// or, if the result is already set, on the thread which sets the
+  /// continuation.
+  template <typename T>
+  class FutureState
+  {
+  public:
+    using Continuation =
+      MoveFunction<void(const std::shared_ptr<FutureState> &)>;
+
+    /// Stores the result and calls the continuation, if any.
+    ///
+    /// @throws std::future_error, if a result has been set before.
+    template <typename ...Args>
+    static void setValue( const std::shared_ptr<FutureState> & self,
+                          Args &&... args )
+    {
+      FutureValue<T> value( std::forward<Args>(args)... );
+      complete( self, [&]( Data & data )
+      {
+        data.value.emplace( std::move(value) );
+      } );
+    }
+
+    static void setException( const std::shared_ptr<FutureState> & self,
+                              std::exception_ptr exception )
+    {
+      complete( self, [&]( Data & data )
+      {
+        data.exception = std::move(exception);
+      } );
+    }
+
+    /// Sets the continuation or calls it right away, if the result is
+    /// already set.
+    static void setContinuation( const std::shared_ptr<FutureState> & self,
+                                 Continuation continuation )
+    {
+      const auto isReady = self->data( [&]( Data & data )
+      {
+        assert( !data.continuation );
+        if ( !data.isReady() )
+          data.continuation = std::move(continuation);
+        return data.isReady();
+      } );
+      if ( isReady )
+        continuation( self );
+    }
+
+    /// Removes the continuation, if it has not been called yet.
+    void clearContinuation()
+    {
+      // The continuation is destroyed outside the lock, since it may own
+      // the last reference to this state.
+      auto continuation = data( []( Data & data )
+      {
+        return std::move(data.continuation);
+      } );
+    }
+
+    bool isReady() const
+    {
+      return data( []( const Data & data ){ return data.isReady(); } );
+    }
+
+    void wait() const
+    {
+      data( PassUniqueLockTag(), []( Data & data, std::unique_lock<std::mutex> & lock )
+      {
+        data.condition.wait( lock, [&]{ return data.isReady(); } );
+      } );
+    }
+
+    /// Blocks until the result is set and moves it out.
+    T get()
+    {
+      wait();
+      auto & data = unsynchronizedData();
+      if ( data.exception )
+        std::rethrow_exception( data.exception );
+      return static_cast<T>( std::move( *data.value ) );
+    }
+
+  private:
+    struct Data
+    {
+      optional<FutureValue<T>> value;
+      std::exception_ptr exception;
+      Continuation continuation;
+      mutable std::condition_variable condition;
+
+      bool isReady() const noexcept
+      {
+        return value || exception;
+      }
+    };
+
+    template <typename SetResult>
+    static void complete( const std::shared_ptr<FutureState> & self,
+                          SetResult setResult )
+    {
+      auto continuation = self->data( [&]( Data & data )
+      {
+        if ( data.isReady() )
+          throw std::future_error( std::future_errc::promise_already_satisfied );
+        setResult( data );
+        data.condition.notify_all();
+        return std::move(data.continuation);
+      } );
+      if ( continuation )
+        continuation( self );
+    }
+
+    /// The result never changes after it has been set. Hence, it can be
+    /// accessed without lock after @c wait() has returned.
+    Data & unsynchronizedData()
+    {
+      return data( []( Data & data ) -> Data & { return data; } );
+    }
+
+    mutable Monitor<Data> data;
+  };
+
+  class FutureStateAccess;
+
+  template <typename T>
+  class FutureCoroutinePromise;
+
+  /// Sets the result of @c promise to the result of @c f() or to the
+  /// exception thrown by @c f().
+  template <typename T,
+            typename F>
+  void fulfill( Promise<T> & promise, F && f, std::true_type /*isVoid*/ )
+  {
+    std::forward<F>(f)();
+    promise.setValue();
+  }
+
+  template <typename T,
+            typename F>
+  void fulfill( Promise<T> & promise, F && f, std::false_type /*isVoid*/ )
+  {
+    promise.setValue( std::forward<F>(f)() );
+  }
+
+  template <typename T,
+            typename F>
+  void fulfill( Promise<T> & promise, F && f )
+  {
+    try
+    {
+      fulfill( promise, std::forward<F>(f), std::is_void<T>{} );
+    }
+    catch ( ... )
+    {
+      promise.setException( std::current_exception() );
+    }
+  }
+
+} // namespace detail
+
+
+/// The sending side of a @c Future.
+///
+/// Unlike @c std::promise, a result can be processed by a continuation
+/// as soon as it is set, see @c Future::then().
+/// If a promise is destroyed without having set a result, then its future
+/// receives a @c std::future_error with the code @c broken_promise.
+template <typename T>
+class Promise
+{
+public:
+  Promise()
+    : state( std::make_shared<detail::FutureState<T>>() )
+  {}
+
+  Promise( Promise && ) noexcept = default;
+
+  Promise & operator=( Promise && other ) noexcept
+  {
+    Promise( std::move(other) ).swap( *this );
+    return *this;
+  }
+
+  ~Promise()
+  {
+    if ( state && !state->isReady() )
+      setException( std::make_exception_ptr(
+                      std::future_error( std::future_errc::broken_promise ) ) );
+  }
+
+  void swap( Promise & other ) noexcept
+  {
+    state.swap( other.state );
+    std::swap( futureRetrieved, other.futureRetrieved );
+  }
+
+  /// Returns the future for the result. This must be called only once.
+  Future<T> getFuture()
+  {
+    if ( futureRetrieved )
+      throw std::future_error( std::future_errc::future_already_retrieved );
+    futureRetrieved = true;
+    return Future<T>( state );
+  }
+
+  /// Sets the result. For @c Promise<void> no arguments are passed.
+  /// Otherwise the arguments are forwarded to the constructor of @c T.
+  template <typename ...Args>
+  void setValue( Args &&... args )
+  {
+    detail::FutureState<T>::setValue( state, std::forward<Args>(args)... );
+  }
+
+  void setException( std::exception_ptr exception )
+  {
+    detail::FutureState<T>::setException( state, std::move(exception) );
+  }
+
+private:
+  std::shared_ptr<detail::FutureState<T>> state;
+  bool futureRetrieved = false;
+};
+
+
+/// A future which can be continued without blocking a thread.
+///
+/// This class is a lightweight alternative to @c std::future.
+/// The shared state of a promise and its future is a single allocation.
+/// With @c then() a continuation is scheduled on an executor as soon as
+/// the result is ready. No thread is parked waiting for it.
+/// @c whenAll() and @c whenAny() combine several futures.
+///
+/// Futures are created by @c Promise::getFuture(), @c launch(), @c then(),
+/// @c whenAll() and @c whenAny().
+template <typename T>
+class Future
+{
+public:
+  Future() = default;
+
+  /// Returns @c true, if this object refers to a shared state.
+  bool valid() const noexcept
+  {
+    return state != nullptr;
+  }
+
+  /// Returns @c true, if the result is set.
+  bool isReady() const
+  {
+    assert( valid() );
+    return state->isReady();
+  }
+
+  /// Blocks until the result is set.
+  void wait() const
+  {
+    assert( valid() );
+    state->wait();
+  }
+
+  /// Blocks until the result is set and returns it or rethrows the
+  /// exception it holds. Afterwards, the future is not valid anymore.
+  T get()
+  {
+    assert( valid() );
+    const auto s = std::move(state);
+    return s->get();
+  }
+
+  /// Schedules @c f on @c executor once the result is ready.
+  ///
+  /// @c f is called with this future, which is ready at that time, as
+  /// argument. Hence, @c f can get the result or handle the exception.
+  /// Afterwards this future is not valid anymore.
+  /// The @c executor must provide a @c post() member function like
+  /// @c TaskQueueThreadPool and @c Strand do, and must outlive the
+  /// continuation. Arguments passed by the executor to its tasks are
+  /// ignored.
+  ///
+  /// @returns a future for the result of @c f.
+  ///
+  /// @example
+  ///   @code
+  ///     cu::launch( pool, []{ return loadData(); } )
+  ///       .then( pool, []( cu::Future<Data> data ){ return process( data.get() ); } )
+  ///       .then( guiThread, []( cu::Future<Result> result ){ show( result.get() ); } );
+  ///   @endcode
+  template <typename Executor,
+            typename F>
+  auto then( Executor & executor, F && f )
+  {
+    assert( valid() );
+    using R = std::result_of_t<std::decay_t<F>(Future<T>)>;
+    Promise<R> promise;
+    auto result = promise.getFuture();
+    auto continuation =
+      [ executor = &executor
+      , promise = std::move(promise)
+      , f = std::decay_t<F>( std::forward<F>(f) ) ]
+      ( const std::shared_ptr<detail::FutureState<T>> & state ) mutable
+    {
+      auto task =
+        [ promise = std::move(promise)
+        , f = std::move(f)
+        , future = Future<T>( state ) ]( auto &&... ) mutable
+      {
+        detail::fulfill( promise, [&]{ return f( std::move(future) ); } );
+      };
+      try
+      {
+        executor->post( std::move(task) );
+      }
+      catch ( ... )
+      {
+        // The continuation must not throw into the thread which sets the
+        // result. The promise is destroyed with the task. Hence, the
+        // returned future receives a broken_promise error.
+      }
+    };
+    detail::FutureState<T>::setContinuation(
+          std::exchange( state, nullptr ), std::move(continuation) );
+    return result;
+  }
+
+#ifdef CU_HAS_COROUTINES
+  /// Makes a function returning a @c Future<T> a coroutine.
+  ///
+  /// The coroutine starts eagerly. Its @c co_return value or the exception
+  /// escaping it becomes the result of the future.
+  using promise_type = detail::FutureCoroutinePromise<T>;
+
+  /// Suspends the awaiting coroutine until the result is ready.
+  ///
+  /// The coroutine is resumed on the thread which sets the result. Use
+  /// @c cu::schedule() afterwards to continue somewhere else. The result of
+  /// the @c co_await expression is the result of @c get().
+  /// Afterwards, this future is not valid anymore.
+  auto operator co_await()
+  {
+    assert( valid() );
+    struct Awaiter
+    {
+      std::shared_ptr<detail::FutureState<T>> state;
+
+      bool await_ready() const
+      {
+        return state->isReady();
+      }
+
+      void await_suspend( std::coroutine_handle<> coroutine )
+      {
+        // The coroutine may be resumed and destroyed on another thread
+        // before this call returns. Hence, the state is kept alive by a copy.
+        const auto keepAlive = state;
+        detail::FutureState<T>::setContinuation( keepAlive,
+          [coroutine]( const std::shared_ptr<detail::FutureState<T>> & )
+        {
+          coroutine.resume();
+        } );
+      }
+
+      T await_resume()
+      {
+        return state->get();
+      }
+    };
+    return Awaiter{ std::exchange( state, nullptr ) };
+  }
+#endif
+
+private:
+  friend class Promise<T>;
+  friend class detail::FutureStateAccess;
+
+  explicit Future( std::shared_ptr<detail::FutureState<T>> state_ )
+    : state( std::move(state_) )
+  {}
+
+  std::shared_ptr<detail::FutureState<T>> state;
+};
+
+
+namespace detail
+{
+#ifdef CU_HAS_COROUTINES
+  /// The promise type of coroutines returning a @c Future<T>.
+  template <typename T>
+  class FutureCoroutinePromiseBase
+  {
+  public:
+    Future<T> get_return_object()
+    {
+      return promise.getFuture();
+    }
+
+    std::suspend_never initial_suspend() const noexcept
+    {
+      return {};
+    }
+
+    std::suspend_never final_suspend() const noexcept
+    {
+      return {};
+    }
+
+    void unhandled_exception()
+    {
+      promise.setException( std::current_exception() );
+    }
+
+  protected:
+    Promise<T> promise;
+  };
+
+  template <typename T>
+  class FutureCoroutinePromise
+      : public FutureCoroutinePromiseBase<T>
+  {
+  public:
+    template <typename U>
+    void return_value( U && value )
+    {
+      this->promise.setValue( std::forward<U>(value) );
+    }
+  };
+
+  template <>
+  class FutureCoroutinePromise<void>
+      : public FutureCoroutinePromiseBase<void>
+  {
+  public:
+    void return_void()
+    {
+      this->promise.setValue();
+    }
+  };
+#endif
+
+  /// Gives the combinators access to the shared states of futures.
+  class FutureStateAccess
+  {
+  public:
+    template <typename T>
+    static std::vector<std::shared_ptr<FutureState<T>>> getAll(
+        const std::vector<Future<T>> & futures )
+    {
+      std::vector<std::shared_ptr<FutureState<T>>> result;
+      result.reserve( futures.size() );
+      for ( const auto & future : futures )
+      {
+        assert( future.valid() );
+        result.push_back( future.state );
+      }
+      return result;
+    }
+  };
+} // namespace detail
+
+
+/// Runs @c f on @c executor and returns a future for the result.
+///
+/// The @c executor must provide a @c post() member function.
+/// If the executor passes arguments to its tasks, like
+/// @c TaskQueueThreadPool<WorkerData...> does, then their types must be
+/// given as explicit template arguments @c Args and they are passed on to
+/// @c f.
+template <typename ...Args,
+          typename Executor,
+          typename F>
+auto launch( Executor & executor, F && f )
+{
+  using R = std::result_of_t<std::decay_t<F>(Args&...)>;
+  Promise<R> promise;
+  auto result = promise.getFuture();
+  executor.post(
+    [ promise = std::move(promise)
+    , f = std::decay_t<F>( std::forward<F>(f) ) ]( Args &... args ) mutable
+  {
+    detail::fulfill( promise, [&]{ return f( args... ); } );
+  } );
+  return result;
+}
+
+
+/// Returns a future which becomes ready, when all futures in the range
+/// [first,last) are ready.
+///
+/// The futures are moved into the result. No thread is blocked while
+/// waiting. For an empty range the result is ready immediately.
+///
+/// @example
+///   @code
+///     std::vector<cu::Future<int>> parts;
+///     for ( auto i = 0; i < 8; ++i )
+///       parts.push_back( cu::launch( pool, [i]{ return computePart( i ); } ) );
+///     auto total = cu::whenAll( parts.begin(), parts.end() ).then( pool,
+///       []( cu::Future<std::vector<cu::Future<int>>> parts )
+///     {
+///       auto sum = 0;
+///       for ( auto & part : parts.get() )
+///         sum += part.get();
+///       return sum;
+///     } );
+///   @endcode
+template <typename InputIt>
+auto whenAll( InputIt first, InputIt last )
+{
+  using Futures = std::vector<typename std::iterator_traits<InputIt>::value_type>;
+  struct Shared
+  {
+    Futures futures;
+    std::atomic<std::size_t> nRemaining{0};
+    Promise<Futures> promise;
+  };
+  auto shared = std::make_shared<Shared>();
+  auto result = shared->promise.getFuture();
+  shared->futures.assign( std::make_move_iterator(first),
+                          std::make_move_iterator(last) );
+  const auto states = detail::FutureStateAccess::getAll( shared->futures );
+  // The extra count keeps the result from being set before all
+  // continuations have been registered.
+  shared->nRemaining = states.size() + 1;
+  const auto countDown = [shared]( const auto & )
+  {
+    if ( --shared->nRemaining == 0 )
+      shared->promise.setValue( std::move(shared->futures) );
+  };
+  for ( const auto & state : states )
+    state->setContinuation( state, countDown );
+  countDown( nullptr );
+  return result;
+}
+
+
+/// The result of @c whenAny().
+template <typename Futures>
+struct WhenAnyResult
+{
+  /// The index of the future which has become ready first.
+  std::size_t index;
+  /// All futures passed to @c whenAny().
+  Futures futures;
+};
+
+
+/// Returns a future which becomes ready, when any future in the range
+/// [first,last) is ready.
+///
+/// The futures are moved into the result together with the index of the
+/// first one which has become ready. No thread is blocked while waiting.
+/// For an empty range the result holds a @c std::future_error with the code
+/// @c broken_promise.
+///
+/// The returned futures carry no continuations anymore, so they can be
+/// continued or passed to @c whenAny() again.
+///
+/// @example The futures are processed in the order they become ready:
+///   @code
+///     while ( !futures.empty() )
+///     {
+///       auto any = cu::whenAny( futures.begin(), futures.end() ).get();
+///       process( any.futures[any.index].get() );
+///       any.futures.erase( any.futures.begin() + any.index );
+///       futures = std::move( any.futures );
+///     }
+///   @endcode
+template <typename InputIt>
+auto whenAny( InputIt first, InputIt last )
+{
+  using Futures = std::vector<typename std::iterator_traits<InputIt>::value_type>;
+  struct Shared
+  {
+    Futures futures;
+    decltype(detail::FutureStateAccess::getAll( futures )) states;
+    std::atomic<std::size_t> index{0};
+    std::atomic<bool> done{false};
+    /// The first ready future and the registration of the continuations.
+    std::atomic<int> nRemaining{2};
+    Promise<WhenAnyResult<Futures>> promise;
+  };
+  auto shared = std::make_shared<Shared>();
+  auto result = shared->promise.getFuture();
+  shared->futures.assign( std::make_move_iterator(first),
+                          std::make_move_iterator(last) );
+  shared->states = detail::FutureStateAccess::getAll( shared->futures );
+  // The futures are handed out only after all continuations have been
+  // registered and removed again. Otherwise the futures could not be
+  // passed to whenAny() or be continued again.
+  const auto finish = [shared]
+  {
+    if ( --shared->nRemaining != 0 )
+      return;
+    for ( const auto & state : shared->states )
+      state->clearContinuation();
+    shared->states.clear();
+    shared->promise.setValue( WhenAnyResult<Futures>{
+      shared->index.load(), std::move(shared->futures) } );
+  };
+  for ( std::size_t i = 0; i < shared->states.size(); ++i )
+  {
+    const auto & state = shared->states[i];
+    state->setContinuation( state, [shared, i, finish]( const auto & )
+    {
+      if ( shared->done.exchange( true ) )
+        return;
+      shared->index = i;
+      finish();
+    } );
+  }
+  finish();
+  return result;
+}
+
+} // namespace cu
@@ -2,12 +2,40 @@
 
 #include "rank.hpp"
 
+#include <cstddef>
+#include <limits>
 #include <memory>
+#include <stdexcept>
 #include <type_traits>
 
 namespace cu
 {
 
+/// The assumed size of a cache line in bytes.
+///
+/// Data members that are written by different threads should be aligned
+/// to this value in order to avoid false sharing.
+constexpr std::size_t cacheLineSize = 64;
+
+namespace detail
+{
+  /// Returns the smallest power of two which is at least @c n and at
+  /// least two. This is used for the capacities of ring buffers.
+  ///
+  /// @throws std::length_error if the result is not representable.
+  inline std::size_t roundUpToPowerOfTwo( std::size_t n )
+  {
+    constexpr auto maxPowerOfTwo =
+        ( std::numeric_limits<std::size_t>::max() >> 1 ) + 1;
+    if ( n > maxPowerOfTwo )
+      throw std::length_error( "The capacity is too large." );
+    std::size_t result = 2;
+    while ( result < n )
+      result *= 2;
+    return result;
+  }
+} // namespace detail
+
 template <typename T>
 std::unique_ptr<std::decay_t<T>> to_unique_ptr( T && x )
 {
@@ -9,16 +9,21 @@ exists( ../../common_config.pri ) : include( ../../common_config.pri )
 
 HEADERS += \
     algorithm.hpp \
+    bounded_concurrent_queue.hpp \
     c++17_features.hpp \
+    combining_monitor.hpp \
     concurrent.hpp \
     concurrent_queue.hpp \
+    coroutine.hpp \
     cow_ptr.hpp \
     dependency_thread_pool.hpp \
+    event_count.hpp \
     exception.hpp \
     exception_handling.hpp \
     filters.hpp \
     functors.hpp \
     functors_fwd.hpp \
+    future.hpp \
     fwd.hpp \
     geometry.hpp \
     hexdump.hpp \
@@ -30,20 +35,30 @@ HEADERS += \
     meta_functor_binder.hpp \
     meta_programming.hpp \
     monitor.hpp \
+    parallel_algorithms.hpp \
     pimpl_ptr.hpp \
     polynomials.hpp \
+    priority_concurrent_queue.hpp \
     progress.hpp \
     ranges.hpp \
     rank.hpp \
     rational.hpp \
     region_allocator.hpp \
     scope_guard.hpp \
+    seq_lock_monitor.hpp \
+    shared_monitor.hpp \
     slice.hpp \
+    spsc_queue.hpp \
+    strand.hpp \
     string_helpers.hpp \
     swap.hpp \
+    task_graph.hpp \
     task_queue.hpp \
     task_queue_thread.hpp \
     task_queue_thread_pool.hpp \
+    thread_affinity.hpp \
+    tracing.hpp \
     units.hpp \
     updater.hpp \
     visitor.hpp \
+    work_stealing_thread_pool.hpp \
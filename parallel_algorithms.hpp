@@ -0,0 +1,279 @@
+/** @file Defines the parallel algorithms @c cu::parallelFor() and
+ * @c cu::parallelReduce() which run on a thread pool.
+ *
+ * @author Ralph Tandetzky
+ */
+
+#pragma once
+
+#include "c++17_features.hpp"
+#include "event_count.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace cu
+{
+
+/// If passed as grain size to a parallel algorithm, then the range is split
+/// into a few chunks per participating thread.
+constexpr std::size_t automaticGrainSize = 0;
+
+/// If passed as grain size to @c parallelFor(), then each thread claims
+/// a fraction of the remaining range, so chunks shrink towards the end of
+/// the range (guided scheduling). This balances the load well, if the costs
+/// of the iterations vary strongly.
+constexpr std::size_t adaptiveGrainSize = std::numeric_limits<std::size_t>::max();
+
+namespace detail
+{
+  /// The state shared by all threads which participate in a parallel loop.
+  ///
+  /// Indexes are claimed with a single atomic counter and completion is
+  /// tracked with a single atomic counter of finished indexes.
+  class ParallelLoopState
+  {
+  public:
+    ParallelLoopState( std::size_t n_,
+                       std::size_t grainSize_,
+                       std::size_t nParticipants_ )
+      : n( n_ )
+      , grainSize( grainSize_ )
+      , minGrainSize( std::max( std::size_t{1}, n_ / (16*nParticipants_) ) )
+      , nParticipants( nParticipants_ )
+    {}
+
+    /// Processes chunks of indexes until there are no more left.
+    ///
+    /// @c chunk is called with the half-open index range of a chunk.
+    /// After the first exception, the remaining chunks are skipped.
+    template <typename Chunk>
+    void work( Chunk & chunk ) noexcept
+    {
+      std::size_t first = 0, last = 0;
+      while ( claim( first, last ) )
+      {
+        if ( !failed.load( std::memory_order_relaxed ) )
+        {
+          try
+          {
+            chunk( first, last );
+          }
+          catch ( ... )
+          {
+            if ( !failed.exchange( true ) )
+              exception = std::current_exception();
+          }
+        }
+        const auto count = last - first;
+        if ( nFinished.fetch_add( count, std::memory_order_acq_rel ) + count == n )
+          finished.notifyAll();
+      }
+    }
+
+    /// Blocks until all indexes are finished and rethrows the first
+    /// exception, if any.
+    void wait()
+    {
+      finished.wait( [&]{ return nFinished.load( std::memory_order_acquire ) == n; } );
+      if ( exception )
+        std::rethrow_exception( exception );
+    }
+
+  private:
+    bool claim( std::size_t & first, std::size_t & last ) noexcept
+    {
+      if ( grainSize != adaptiveGrainSize )
+      {
+        first = next.fetch_add( grainSize, std::memory_order_relaxed );
+        if ( first >= n )
+          return false;
+        last = std::min( n, first + grainSize );
+        return true;
+      }
+
+      first = next.load( std::memory_order_relaxed );
+      for (;;)
+      {
+        if ( first >= n )
+          return false;
+        const auto size = std::max( minGrainSize, (n - first) / (2*nParticipants) );
+        last = std::min( n, first + size );
+        if ( next.compare_exchange_weak( first, last, std::memory_order_relaxed ) )
+          return true;
+      }
+    }
+
+    const std::size_t n;
+    const std::size_t grainSize;
+    const std::size_t minGrainSize;
+    const std::size_t nParticipants;
+    std::atomic<std::size_t> next{0};
+    std::atomic<std::size_t> nFinished{0};
+    std::atomic<bool> failed{false};
+    std::exception_ptr exception;
+    EventCount finished;
+  };
+
+  /// Returns the grain size to be used for @c n indexes.
+  ///
+  /// Fixed grain sizes are clamped to @c n. Each participant overshoots the
+  /// claim counter by at most one grain size, so a larger grain size might
+  /// make it wrap around and let a late helper claim indexes again.
+  inline std::size_t computeGrainSize(
+      std::size_t n, std::size_t grainSize, std::size_t nParticipants )
+  {
+    if ( grainSize == adaptiveGrainSize )
+      return grainSize;
+    if ( grainSize != automaticGrainSize )
+      return std::min( grainSize, n );
+    return std::max( std::size_t{1}, n / (4*nParticipants) );
+  }
+
+  /// Runs @c chunk on the index range [0,n) split into chunks.
+  ///
+  /// The calling thread participates. Helpers which are posted to the
+  /// pool, but start only after all chunks have been claimed, return
+  /// immediately without touching @c chunk. Therefore, the calling thread
+  /// never waits for helpers that are still queued.
+  template <typename Pool,
+            typename Chunk>
+  void runParallelChunks( Pool & pool,
+                          std::size_t n,
+                          std::size_t grainSize,
+                          Chunk & chunk )
+  {
+    if ( n == 0 )
+      return;
+    const auto nParticipants = pool.workerCount() + 1;
+    grainSize = computeGrainSize( n, grainSize, nParticipants );
+    const auto nChunks = grainSize == adaptiveGrainSize
+        ? n
+        : (n + grainSize - 1) / grainSize;
+    const auto state = std::make_shared<ParallelLoopState>(
+          n, grainSize, nParticipants );
+    const auto chunkPtr = &chunk;
+    const auto nHelpers = std::min( nParticipants - 1, nChunks - 1 );
+    for ( std::size_t i = 0; i < nHelpers; ++i )
+      pool.post( [state, chunkPtr]( auto &&... )
+      {
+        state->work( *chunkPtr );
+      } );
+    state->work( chunk );
+    state->wait();
+  }
+} // namespace detail
+
+
+/// Calls @c f(i) for all @c i in the range [first,last) on the threads
+/// of @c pool and on the calling thread.
+///
+/// @c first and @c last may be integers or random access iterators.
+/// The function returns when all calls have finished. If calls of @c f
+/// throw, then the remaining calls are skipped and the first exception is
+/// rethrown.
+///
+/// @param grainSize The number of consecutive indexes which are processed
+/// as one chunk. By default, a grain size is chosen automatically.
+/// @c adaptiveGrainSize selects guided scheduling.
+///
+/// The @c pool must provide the member functions @c post() and
+/// @c workerCount() like @c TaskQueueThreadPool does.
+/// Calling this function from a worker thread of @c pool is fine.
+template <typename Pool,
+          typename Index,
+          typename F>
+void parallelFor( Pool & pool,
+                  Index first,
+                  Index last,
+                  F && f,
+                  std::size_t grainSize = automaticGrainSize )
+{
+  using Diff = decltype(last - first);
+  const auto n = static_cast<std::size_t>( last - first );
+  auto chunk = [&]( std::size_t chunkFirst, std::size_t chunkLast )
+  {
+    for ( auto i = chunkFirst; i != chunkLast; ++i )
+      f( first + static_cast<Diff>(i) );
+  };
+  detail::runParallelChunks( pool, n, grainSize, chunk );
+}
+
+
+/// Reduces the range [first,last) with the binary operation @c op on the
+/// threads of @c pool and on the calling thread.
+///
+/// The result is @c op(...op(op(init,x1),x2)...,xn), except that the
+/// operations are grouped differently. Therefore @c op must be
+/// associative, but it need not be commutative.
+/// Each chunk is reduced separately and the results of the chunks are
+/// combined in order on the calling thread.
+///
+/// @param grainSize The number of consecutive elements which are reduced
+/// as one chunk. @c adaptiveGrainSize is treated like
+/// @c automaticGrainSize, since the number of chunks must be known in
+/// advance.
+template <typename Pool,
+          typename RandIt,
+          typename T,
+          typename Op>
+T parallelReduce( Pool & pool,
+                  RandIt first,
+                  RandIt last,
+                  T init,
+                  Op && op,
+                  std::size_t grainSize = automaticGrainSize )
+{
+  using Diff = typename std::iterator_traits<RandIt>::difference_type;
+  const auto n = static_cast<std::size_t>( last - first );
+  if ( n == 0 )
+    return init;
+  if ( grainSize == adaptiveGrainSize )
+    grainSize = automaticGrainSize;
+  grainSize = detail::computeGrainSize( n, grainSize, pool.workerCount() + 1 );
+
+  std::vector<optional<T>> partials( (n + grainSize - 1) / grainSize );
+  auto chunk = [&]( std::size_t chunkFirst, std::size_t chunkLast )
+  {
+    auto it = first + static_cast<Diff>(chunkFirst);
+    const auto end = first + static_cast<Diff>(chunkLast);
+    T acc = *it;
+    for ( ++it; it != end; ++it )
+      acc = op( std::move(acc), *it );
+    partials[chunkFirst / grainSize] = std::move(acc);
+  };
+  detail::runParallelChunks( pool, n, grainSize, chunk );
+
+  for ( auto & partial : partials )
+    init = op( std::move(init), std::move(*partial) );
+  return init;
+}
+
+
+/// Reduces all elements of @c range with the binary operation @c op.
+///
+/// See the iterator overload for details.
+template <typename Pool,
+          typename Range,
+          typename T,
+          typename Op>
+T parallelReduce( Pool & pool,
+                  const Range & range,
+                  T init,
+                  Op && op,
+                  std::size_t grainSize = automaticGrainSize )
+{
+  using std::begin;
+  using std::end;
+  return parallelReduce( pool, begin(range), end(range), std::move(init),
+                         std::forward<Op>(op), grainSize );
+}
+
+} // namespace cu
@@ -0,0 +1,197 @@
+/** @file Defines the class cu::PriorityConcurrentQueue.
+ * @author Ralph Tandetzky
+ */
+
+#pragma once
+
+#include "c++17_features.hpp"
+#include "monitor.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <type_traits>
+
+namespace cu
+{
+
+/// The lanes of a @c PriorityConcurrentQueue in order of decreasing priority.
+enum class TaskPriority
+{
+  high,
+  normal,
+  low
+};
+
+
+/// Thread-safe queue with several priority lanes.
+///
+/// This class has the same interface as @c ConcurrentQueue. Elements pushed
+/// with @c push() or @c emplace() go into the lane @c TaskPriority::normal.
+/// Other lanes can be chosen with @c emplaceWithPriority().
+/// Popping always takes the oldest element of the highest non-empty lane,
+/// unless a lower lane is starving: Whenever a non-empty lane has been
+/// bypassed @c maxBypassCount times in a row, its oldest element is popped
+/// next. This keeps the lower lanes moving while higher lanes are flooded.
+///
+/// Like @c ConcurrentQueue, this queue recycles its list nodes and does not
+/// allocate memory in steady state.
+///
+/// The type @c T must be nothrow move constructible for the class to work.
+template <typename T>
+class PriorityConcurrentQueue
+{
+public:
+  /// Creates an empty queue.
+  ///
+  /// @param maxBypassCount The number of times a non-empty lane may be
+  /// passed over in favor of higher lanes before it is served once.
+  explicit PriorityConcurrentQueue( std::size_t maxBypassCount = 16 )
+    : maxBypassCount( std::max( std::size_t{1}, maxBypassCount ) )
+  {}
+
+  /// Copies an item into the normal lane of the queue.
+  ///
+  /// This function provides the strong exception guarantee.
+  void push( const T & item )
+  {
+    emplace( item );
+  }
+
+  /// Moves an item into the normal lane of the queue.
+  ///
+  /// This function provides the strong exception guarantee.
+  void push( T && item )
+  {
+    emplace( std::move(item) );
+  }
+
+  /// Emplaces an item into the normal lane of the queue.
+  ///
+  /// This function provides the strong exception guarantee.
+  template <typename ...Args>
+  void emplace( Args &&... args )
+  {
+    emplaceWithPriority( TaskPriority::normal, std::forward<Args>(args)... );
+  }
+
+  /// Emplaces an item into the lane selected by @c priority.
+  ///
+  /// This function provides the strong exception guarantee.
+  template <typename ...Args>
+  void emplaceWithPriority( TaskPriority priority, Args &&... args )
+  {
+    T item( std::forward<Args>(args)... );
+    data( [&]( Data & data )
+    {
+      auto & lane = data.lanes[static_cast<std::size_t>(priority)];
+      if ( data.freeNodes.empty() )
+      {
+        lane.emplace_back(); // may throw.
+        ++nNodeAllocations;
+      }
+      else
+        lane.splice( lane.end(), data.freeNodes, data.freeNodes.begin() );
+      // commit
+      lane.back().emplace( std::move(item) );
+      data.condition.notify_one(); // does not throw.
+    });
+  }
+
+  /// Pops an item from the queue and returns it.
+  ///
+  /// If there's no item in the queue, then the function will block until there
+  /// is one.
+  T pop()
+  {
+    return data( PassUniqueLockTag(), [this]( Data & data, std::unique_lock<std::mutex> & lock )
+    {
+      data.condition.wait( lock, [&](){ return !data.isEmpty(); } );
+      return data.popFront( maxBypassCount );
+    });
+  }
+
+  /// Pops an item off the queue, blocking for at most @c maxWaitDuration.
+  ///
+  /// If the queue is empty for @c maxWaitDuration, then
+  /// @c std::nullopt is returned.
+  /// Otherwise this function returns the popped element.
+  template <typename Rep,
+            typename Period>
+  optional<T> tryPopFor(
+      const std::chrono::duration<Rep, Period> & maxWaitDuration )
+  {
+    return data( PassUniqueLockTag(), [&]( Data & data, std::unique_lock<std::mutex> & lock )
+      -> optional<T>
+    {
+      const auto success = data.condition.wait_for(
+            lock, maxWaitDuration, [&](){ return !data.isEmpty(); } );
+      if ( !success )
+        return nullopt;
+      return data.popFront( maxBypassCount );
+    });
+  }
+
+  /// Returns the number of list nodes that have been allocated so far.
+  std::size_t nodeAllocationCount() const noexcept
+  {
+    return nNodeAllocations.load( std::memory_order_relaxed );
+  }
+
+private:
+  static_assert( std::is_nothrow_move_constructible<T>::value,
+                 "The item type must be nothrow move constructible." );
+
+  using Nodes = std::list<optional<T>>;
+  static constexpr std::size_t nLanes = 3;
+
+  struct Data
+  {
+    std::array<Nodes,nLanes> lanes;
+    std::array<std::size_t,nLanes> bypassCounts{};
+    Nodes freeNodes;
+    std::condition_variable condition;
+
+    bool isEmpty() const noexcept
+    {
+      for ( const auto & lane : lanes )
+        if ( !lane.empty() )
+          return false;
+      return true;
+    }
+
+    /// Pops from the highest non-empty lane or from a starving lower lane.
+    T popFront( std::size_t maxBypassCount ) noexcept
+    {
+      assert( !isEmpty() );
+      std::size_t highest = 0;
+      while ( lanes[highest].empty() )
+        ++highest;
+      auto chosen = highest;
+      for ( auto i = highest + 1; i < nLanes; ++i )
+      {
+        if ( lanes[i].empty() )
+          continue;
+        if ( ++bypassCounts[i] >= maxBypassCount && chosen == highest )
+          chosen = i;
+      }
+      bypassCounts[chosen] = 0;
+
+      auto & lane = lanes[chosen];
+      T result( std::move( *lane.front() ) );
+      lane.front() = nullopt;
+      freeNodes.splice( freeNodes.begin(), lane, lane.begin() );
+      return result;
+    }
+  };
+
+  const std::size_t maxBypassCount;
+  Monitor<Data> data;
+  std::atomic<std::size_t> nNodeAllocations{0};
+};
+
+} // namespace cu
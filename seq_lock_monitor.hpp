@@ -0,0 +1,162 @@
+/** @file Defines the template class @c cu::SeqLockMonitor which implements
+ * the monitor pattern with a sequence lock.
+ *
+ * @author Ralph Tandetzky
+ */
+
+#pragma once
+
+#include "memory_helpers.hpp"
+#include "scope_guard.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+namespace cu
+{
+
+/// A monitor for small trivially copyable data, which is read far more
+/// often than it is written.
+///
+/// Readers never block and never write to shared memory. They copy the
+/// data optimistically and retry, if a writer has published a new value
+/// in the meantime. Hence, readers neither slow down writers nor each
+/// other by bouncing cache lines between cores.
+///
+/// Writers are serialized by a mutex. They apply their functor to a
+/// private copy of the data like with @c Monitor and publish the result
+/// afterwards. Readers only retry, while a result is being published, but
+/// not while the functor runs.
+///
+/// The published data is stored in atomic words which are accessed with
+/// relaxed loads and stores. Together with the fences around them this
+/// avoids data races in the sense of the C++ memory model. The costs of a
+/// read are a copy of the data and two loads of the sequence counter.
+///
+/// @example Telemetry counters, which are read by many threads:
+///   @code
+///     struct Stats
+///     {
+///       std::uint64_t nPackets;
+///       std::uint64_t nBytes;
+///       std::chrono::steady_clock::time_point lastPacket;
+///     };
+///
+///     SeqLockMonitor<Stats> stats;
+///
+///     // writer
+///     stats( [&]( Stats & stats )
+///     {
+///       ++stats.nPackets;
+///       stats.nBytes += packet.size();
+///       stats.lastPacket = now;
+///     } );
+///
+///     // reader
+///     const auto snapshot = stats.load();
+///   @endcode
+template <typename T>
+class SeqLockMonitor
+{
+  static_assert( std::is_trivially_copyable<T>::value,
+                 "SeqLockMonitor requires a trivially copyable type." );
+
+public:
+  /// Forwards all arguments to the wrapped type's constructor.
+  template <typename ...Args>
+  SeqLockMonitor( Args &&... args )
+    : item( std::forward<Args>(args)... )
+  {
+    publish();
+  }
+
+  /// Locks the mutex for writers, applies the passed functor to the
+  /// wrapped item and publishes the modified item to readers.
+  ///
+  /// The item is published even if the functor throws.
+  ///
+  /// @returns whatever the functor returns.
+  template <typename F>
+  decltype(auto) operator()( F && f )
+  {
+    std::lock_guard<std::mutex> lock(writerMutex);
+    CU_SCOPE_EXIT
+    {
+      publish();
+    };
+    return std::forward<F>(f)( item );
+  }
+
+  /// Applies the passed functor to a consistent copy of the item.
+  ///
+  /// This does not block.
+  ///
+  /// @returns whatever the functor returns.
+  template <typename F>
+  decltype(auto) operator()( F && f ) const
+  {
+    const T copy = load();
+    return std::forward<F>(f)( copy );
+  }
+
+  /// Returns a consistent copy of the item.
+  ///
+  /// This does not block and does not write to shared memory.
+  T load() const noexcept
+  {
+    Word buffer[nWords];
+    for ( ;; )
+    {
+      const auto before = sequence.load( std::memory_order_acquire );
+      if ( !( before & 1 ) )
+      {
+        for ( std::size_t i = 0; i < nWords; ++i )
+          buffer[i] = words[i].load( std::memory_order_relaxed );
+        std::atomic_thread_fence( std::memory_order_acquire );
+        if ( sequence.load( std::memory_order_relaxed ) == before )
+          break;
+      }
+      // A writer publishes a new value. Since this is short, yielding
+      // only happens, if the writer has been preempted.
+      std::this_thread::yield();
+    }
+    // T need not be default constructible.
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type result;
+    std::memcpy( &result, buffer, sizeof(T) );
+    return reinterpret_cast<const T &>( result );
+  }
+
+private:
+  using Word = std::size_t;
+
+  static constexpr std::size_t nWords =
+      ( sizeof(T) + sizeof(Word) - 1 ) / sizeof(Word);
+
+  /// Copies the item to the words, which are read by readers.
+  ///
+  /// The mutex for writers must be locked.
+  void publish() noexcept
+  {
+    Word buffer[nWords] = {};
+    std::memcpy( buffer, &item, sizeof(T) );
+    const auto before = sequence.load( std::memory_order_relaxed );
+    sequence.store( before + 1, std::memory_order_relaxed );
+    std::atomic_thread_fence( std::memory_order_release );
+    for ( std::size_t i = 0; i < nWords; ++i )
+      words[i].store( buffer[i], std::memory_order_relaxed );
+    sequence.store( before + 2, std::memory_order_release );
+  }
+
+  /// Is odd, while a writer publishes a new value.
+  alignas(cacheLineSize) std::atomic<std::size_t> sequence{0};
+  std::atomic<Word> words[nWords];
+  /// The item, which is only accessed by writers.
+  alignas(cacheLineSize) T item;
+  std::mutex writerMutex;
+};
+
+} // namespace cu
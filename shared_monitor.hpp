@@ -0,0 +1,239 @@
+/** @file Defines the template class @c cu::SharedMonitor which implements
+ * the monitor pattern with a readers-writer lock.
+ *
+ * @author Ralph Tandetzky
+ */
+
+#pragma once
+
+#include "monitor.hpp"
+#include "swap.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+
+namespace cu
+{
+
+/// Tag class which indicates to a function that it should pass an
+/// @c std::shared_lock to a functor.
+struct PassSharedLockTag {};
+
+/// A readers-writer mutex which prefers writers.
+///
+/// As soon as a writer waits for the lock, no new readers are admitted.
+/// Hence, writers cannot be starved by a steady stream of overlapping
+/// readers, as it can happen with @c std::shared_mutex on some platforms.
+///
+/// Readers which do not meet a writer only perform a single atomic
+/// operation for locking and unlocking. Writers are serialized by a mutex
+/// and wait until the admitted readers have left.
+///
+/// This class meets the requirements of the @c SharedMutex concept. Hence,
+/// it can be used with @c std::shared_lock and @c std::unique_lock.
+class WriterPreferringSharedMutex
+{
+public:
+  WriterPreferringSharedMutex() = default;
+  WriterPreferringSharedMutex( const WriterPreferringSharedMutex & ) = delete;
+  WriterPreferringSharedMutex & operator=( const WriterPreferringSharedMutex & ) = delete;
+
+  void lock()
+  {
+    writerMutex.lock();
+    // From now on no new readers are admitted.
+    if ( state.fetch_or( writerBit, std::memory_order_acquire ) == 0 )
+      return;
+    std::unique_lock<std::mutex> lock( waitMutex );
+    readersLeft.wait( lock, [this]
+    {
+      return state.load( std::memory_order_acquire ) == writerBit;
+    } );
+  }
+
+  bool try_lock()
+  {
+    if ( !writerMutex.try_lock() )
+      return false;
+    auto expected = std::uint32_t{0};
+    if ( state.compare_exchange_strong( expected, writerBit,
+                                        std::memory_order_acquire ) )
+      return true;
+    writerMutex.unlock();
+    return false;
+  }
+
+  void unlock()
+  {
+    {
+      std::lock_guard<std::mutex> lock( waitMutex );
+      state.store( 0, std::memory_order_release );
+    }
+    writerLeft.notify_all();
+    writerMutex.unlock();
+  }
+
+  void lock_shared()
+  {
+    if ( try_lock_shared() )
+      return;
+    std::unique_lock<std::mutex> lock( waitMutex );
+    writerLeft.wait( lock, [this]{ return try_lock_shared(); } );
+  }
+
+  bool try_lock_shared()
+  {
+    auto expected = state.load( std::memory_order_relaxed );
+    while ( !( expected & writerBit ) )
+    {
+      if ( state.compare_exchange_weak( expected, expected + 1,
+                                        std::memory_order_acquire,
+                                        std::memory_order_relaxed ) )
+        return true;
+    }
+    return false;
+  }
+
+  void unlock_shared()
+  {
+    if ( state.fetch_sub( 1, std::memory_order_release ) != writerBit + 1 )
+      return;
+    // The last reader has left and a writer is waiting.
+    {
+      std::lock_guard<std::mutex> lock( waitMutex );
+    }
+    readersLeft.notify_one();
+  }
+
+private:
+  static constexpr std::uint32_t writerBit = std::uint32_t{1} << 31;
+
+  /// The writer bit and the number of readers in the lower bits.
+  std::atomic<std::uint32_t> state{0};
+  /// Is held by the writer from the start of @c lock() to the end of
+  /// @c unlock().
+  std::mutex writerMutex;
+  std::mutex waitMutex;
+  std::condition_variable readersLeft;
+  std::condition_variable writerLeft;
+};
+
+
+/// A monitor wrapper, which lets const accessors run in parallel.
+///
+/// This class works like @c Monitor, but is based on a readers-writer
+/// lock. The const function call operators take a shared lock and pass a
+/// const reference to the wrapped item to the functor. The non-const ones
+/// take an exclusive lock. Hence, read-mostly data like configurations or
+/// lookup tables can be accessed by many threads in parallel. Note that the
+/// non-const function call operator is chosen for non-const monitors, even
+/// if the functor only reads. Hence, readers should access the monitor
+/// through a const reference.
+///
+/// By default @c std::shared_mutex is used. If writers must not be starved
+/// by readers, then @c WriterPreferringSharedMutex can be passed as second
+/// template argument.
+///
+/// For the use of condition variables a @c PassUniqueLockTag or a
+/// @c PassSharedLockTag can be passed to the function call operator, which
+/// will then call the functor with an additional reference to the
+/// @c std::unique_lock or @c std::shared_lock respectively. These locks can
+/// be waited on with @c std::condition_variable_any.
+///
+/// @example A routing table which is rarely updated:
+///   @code
+///     class Router
+///     {
+///     public:
+///       Address lookup( const Key & key ) const
+///       {
+///         return table( [&]( const Table & table ){ return table.at( key ); } );
+///       }
+///
+///       void update( const Key & key, const Address & address )
+///       {
+///         table( [&]( Table & table ){ table[key] = address; } );
+///       }
+///
+///     private:
+///       SharedMonitor<Table> table;
+///     };
+///   @endcode
+template <typename T,
+          typename SharedMutex = std::shared_mutex>
+class SharedMonitor
+{
+private:
+  T item;
+  mutable SharedMutex mutex;
+
+public:
+  /// Forwards all arguments to the wrapped type's constructor.
+  template <typename ...Args>
+  SharedMonitor( Args &&... args )
+    : item( std::forward<Args>(args)... )
+  {
+  }
+
+  /// Locks the mutex exclusively and applies the passed functor to the
+  /// wrapped item.
+  ///
+  /// @returns whatever the functor returns.
+  template <typename F>
+  decltype(auto) operator()( F && f )
+  {
+    std::lock_guard<SharedMutex> lock(mutex);
+    return std::forward<F>(f)( item );
+  }
+
+  /// Locks the mutex shared and applies the passed functor to the wrapped
+  /// item.
+  ///
+  /// @returns whatever the functor returns.
+  template <typename F>
+  decltype(auto) operator()( F && f ) const
+  {
+    std::shared_lock<SharedMutex> lock(mutex);
+    return std::forward<F>(f)( item );
+  }
+
+  /// The same as the non-const function call operator, but the locking
+  /// @c std::unique_lock is passed to the given functor.
+  template <typename F>
+  decltype(auto) operator()( PassUniqueLockTag, F && f )
+  {
+    std::unique_lock<SharedMutex> lock(mutex);
+    return std::forward<F>(f)( item, lock );
+  }
+
+  /// The same as the const function call operator, but the locking
+  /// @c std::shared_lock is passed to the given functor.
+  template <typename F>
+  decltype(auto) operator()( PassSharedLockTag, F && f ) const
+  {
+    std::shared_lock<SharedMutex> lock(mutex);
+    return std::forward<F>(f)( item, lock );
+  }
+
+  /// Atomically swaps the contents of @c this object with the @c other object.
+  void exchange( T & other )
+  {
+    (*this)( [&]( T & mine ){ ::cu::swap( mine, other ); } );
+  }
+
+  void exchange( T && other )
+  {
+    exchange( other );
+  }
+
+  /// Returns the contents of this object.
+  T load() const
+  {
+    return (*this)( []( const T & item ){ return item; } );
+  }
+};
+
+} // namespace cu
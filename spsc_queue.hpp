@@ -0,0 +1,214 @@
+/** @file Defines the class cu::SpscQueue.
+ * @author Ralph Tandetzky
+ */
+
+#pragma once
+
+#include "c++17_features.hpp"
+#include "event_count.hpp"
+#include "memory_helpers.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <new>
+#include <type_traits>
+
+namespace cu
+{
+
+/// Wait-free bounded queue for exactly one producer and one consumer thread.
+///
+/// This class has the same interface as @c ConcurrentQueue, but it may only
+/// be used by one producer thread and one consumer thread at a time.
+/// The elements are stored in a ring buffer of fixed capacity which is
+/// allocated once at construction. The read and write indices live on
+/// separate cache lines and each side caches the index of the other side,
+/// so that the cache line of the other side is only touched when the
+/// queue appears to be empty or full.
+///
+/// Pushing into a non-full queue and popping from a non-empty queue are
+/// wait-free. Otherwise the calling thread spins briefly and then parks
+/// on an @c EventCount.
+///
+/// The type @c T must be nothrow move constructible.
+template <typename T>
+class SpscQueue
+{
+public:
+  /// Creates a queue which can hold at least @c minCapacity elements.
+  ///
+  /// The capacity is rounded up to the next power of two.
+  ///
+  /// @throws std::length_error if the rounded capacity is not representable.
+  explicit SpscQueue( std::size_t minCapacity = 1024 )
+    : mask( detail::roundUpToPowerOfTwo( minCapacity ) - 1 )
+    , slots( std::make_unique<Slot[]>( mask + 1 ) )
+  {}
+
+  SpscQueue( const SpscQueue & ) = delete;
+  SpscQueue & operator=( const SpscQueue & ) = delete;
+
+  /// Destroys the remaining elements.
+  ~SpscQueue()
+  {
+    while ( tryPop() )
+    {
+    }
+  }
+
+  /// Copies an item into the queue.
+  ///
+  /// If the queue is full, then the function will block until there is
+  /// space. This function provides the strong exception guarantee.
+  void push( const T & item )
+  {
+    emplace( item );
+  }
+
+  /// Moves an item into the queue.
+  ///
+  /// If the queue is full, then the function will block until there is
+  /// space. This function provides the strong exception guarantee.
+  void push( T && item )
+  {
+    emplace( std::move(item) );
+  }
+
+  /// Emplaces an item into the queue, i. e. constructor arguments are forwarded.
+  ///
+  /// If the queue is full, then the function will block until there is
+  /// space. This function provides the strong exception guarantee.
+  template <typename ...Args>
+  void emplace( Args &&... args )
+  {
+    if ( !isFull() )
+    {
+      // fast path: construct in place.
+      const auto pos = producer.pos.load( std::memory_order_relaxed );
+      ::new( static_cast<void*>( slots[pos & mask].get() ) )
+          T( std::forward<Args>(args)... );
+      publish( pos );
+      return;
+    }
+
+    T item( std::forward<Args>(args)... );
+    notFull.wait( [&]{ return !isFull(); } );
+    const auto pos = producer.pos.load( std::memory_order_relaxed );
+    ::new( static_cast<void*>( slots[pos & mask].get() ) ) T( std::move(item) );
+    publish( pos );
+  }
+
+  /// Pops an item from the queue and returns it.
+  ///
+  /// If there's no item in the queue, then the function will block until there
+  /// is one.
+  T pop()
+  {
+    if ( isEmpty() )
+      notEmpty.wait( [&]{ return !isEmpty(); } );
+    return take();
+  }
+
+  /// Pops an item off the queue without blocking.
+  ///
+  /// @returns @c std::nullopt, if the queue is empty.
+  optional<T> tryPop()
+  {
+    if ( isEmpty() )
+      return nullopt;
+    return take();
+  }
+
+  /// Pops an item off the queue, blocking for at most @c maxWaitDuration.
+  ///
+  /// If the queue is empty for @c maxWaitDuration, then
+  /// @c std::nullopt is returned.
+  /// Otherwise this function returns the popped element.
+  template <typename Rep,
+            typename Period>
+  optional<T> tryPopFor(
+      const std::chrono::duration<Rep, Period> & maxWaitDuration )
+  {
+    if ( isEmpty() &&
+         !notEmpty.waitUntil( [&]{ return !isEmpty(); },
+                              std::chrono::steady_clock::now() + maxWaitDuration ) )
+      return nullopt;
+    return take();
+  }
+
+  /// Returns the maximum number of elements the queue can hold.
+  std::size_t capacity() const noexcept
+  {
+    return mask + 1;
+  }
+
+private:
+  static_assert( std::is_nothrow_move_constructible<T>::value,
+                 "The item type must be nothrow move constructible." );
+
+  struct Slot
+  {
+    typename std::aligned_storage<sizeof(T),alignof(T)>::type storage;
+
+    T * get() noexcept
+    {
+      return reinterpret_cast<T*>( &storage );
+    }
+  };
+
+  /// The index owned by one side and the cached index of the other side.
+  struct alignas(cacheLineSize) Side
+  {
+    std::atomic<std::size_t> pos{0};
+    std::size_t cachedOtherPos = 0;
+  };
+
+  // Called by the producer only.
+  bool isFull() noexcept
+  {
+    const auto pos = producer.pos.load( std::memory_order_relaxed );
+    if ( pos - producer.cachedOtherPos <= mask )
+      return false;
+    producer.cachedOtherPos = consumer.pos.load( std::memory_order_acquire );
+    return pos - producer.cachedOtherPos > mask;
+  }
+
+  // Called by the producer only.
+  void publish( std::size_t pos ) noexcept
+  {
+    producer.pos.store( pos + 1, std::memory_order_release );
+    notEmpty.notifyOne();
+  }
+
+  // Called by the consumer only.
+  bool isEmpty() noexcept
+  {
+    const auto pos = consumer.pos.load( std::memory_order_relaxed );
+    if ( pos != consumer.cachedOtherPos )
+      return false;
+    consumer.cachedOtherPos = producer.pos.load( std::memory_order_acquire );
+    return pos == consumer.cachedOtherPos;
+  }
+
+  // Called by the consumer only, if the queue is not empty.
+  T take() noexcept
+  {
+    const auto pos = consumer.pos.load( std::memory_order_relaxed );
+    auto & item = *slots[pos & mask].get();
+    T result( std::move(item) );
+    item.~T();
+    consumer.pos.store( pos + 1, std::memory_order_release );
+    notFull.notifyOne();
+    return result;
+  }
+
+  const std::size_t mask;
+  const std::unique_ptr<Slot[]> slots;
+  Side producer;
+  Side consumer;
+  EventCount notEmpty;
+  EventCount notFull;
+};
+
+} // namespace cu
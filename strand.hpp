@@ -0,0 +1,176 @@
+/** @file Defines the class @c Strand.
+ * @author Ralph Tandetzky
+ */
+
+#pragma once
+
+#include "functors.hpp"
+#include "monitor.hpp"
+#include "task_queue.hpp"
+#include "task_queue_thread_pool.hpp"
+
+#include <algorithm>
+#include <deque>
+#include <iterator>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace cu
+{
+
+/// An executor which runs its tasks one after another on a shared
+/// @c TaskQueueThreadPool.
+///
+/// Tasks of the same strand never run concurrently and they run in the
+/// order they have been added. Tasks of different strands may run in
+/// parallel on the workers of the pool. Hence, a strand serializes the
+/// accesses to an object like a @c TaskQueueThread does, but without
+/// occupying a thread of its own. Thousands of strands can share a pool.
+///
+/// A strand is scheduled on the pool only while it has pending tasks.
+/// When it is scheduled, it runs up to @c maxBatchSize pending tasks in one
+/// turn before it is put back into the queue of the pool. This reduces the
+/// scheduling overhead for strands with a backlog while still letting other
+/// tasks of the pool make progress.
+///
+/// The class can be used as executor for @c Concurrent and @c Updater:
+///   @code
+///     cu::TaskQueueThreadPool<> pool;
+///     cu::Concurrent<Data, cu::Strand<>> data{ cu::Strand<>( pool ) };
+///     cu::Updater<cu::Strand<>> updater( pool );
+///   @endcode
+///
+/// Copies of a strand refer to the same strand. Pending tasks are executed,
+/// even if all copies of a strand have been destroyed. The pool must outlive
+/// the pending tasks of its strands.
+///
+/// The @c WorkerData of the pool are passed on to the tasks.
+template <typename ...WorkerData>
+class Strand
+{
+public:
+  using Pool = TaskQueueThreadPool<WorkerData...>;
+
+  /// Creates a strand running on @c pool.
+  ///
+  /// @param maxBatchSize The maximum number of tasks which are executed
+  /// in one scheduling turn of the strand.
+  explicit Strand( Pool & pool, std::size_t maxBatchSize = 16 )
+    : impl( std::make_shared<Impl>( pool, maxBatchSize ) )
+  {}
+
+  /// Adds a task to the strand.
+  ///
+  /// @returns A @c std::future for the result.
+  template <typename F>
+  auto operator()( F && f )
+  {
+    auto taskAndFuture =
+        detail::makePackagedTask<WorkerData&...>( std::forward<F>(f) );
+    Impl::push( impl, std::move(taskAndFuture.first) );
+    return std::move(taskAndFuture.second);
+  }
+
+  /// Adds a task to the strand without creating a future.
+  ///
+  /// Exceptions escaping the task are passed to @c cu::handleException().
+  template <typename F>
+  void post( F && f )
+  {
+    Impl::push( impl, detail::makeExceptionHandlingTask<WorkerData&...>(
+                  std::forward<F>(f) ) );
+  }
+
+private:
+  using Task = MoveFunction<void(WorkerData&...)>;
+
+  class Impl
+  {
+  public:
+    Impl( Pool & pool_, std::size_t maxBatchSize_ )
+      : pool( pool_ )
+      , maxBatchSize( std::max( std::size_t{1}, maxBatchSize_ ) )
+    {}
+
+    /// Appends a task and schedules the strand, if it is not scheduled yet.
+    static void push( const std::shared_ptr<Impl> & self, Task task )
+    {
+      const auto wasScheduled = self->data( [&]( Data & data )
+      {
+        data.pending.push_back( std::move(task) );
+        return std::exchange( data.scheduled, true );
+      } );
+      if ( !wasScheduled )
+        schedule( self );
+    }
+
+  private:
+    struct Data
+    {
+      std::deque<Task> pending;
+      bool scheduled = false;
+    };
+
+    /// Puts the strand into the queue of the pool.
+    ///
+    /// Must only be called by the owner of the scheduled flag. If the pool
+    /// throws, then the flag is reset, so the next @c push() schedules the
+    /// strand again, and the exception is rethrown. The pending tasks stay
+    /// in the strand.
+    static void schedule( const std::shared_ptr<Impl> & self )
+    {
+      try
+      {
+        self->pool.post( [self]( WorkerData &... workerData )
+        {
+          runBatch( self, workerData... );
+        } );
+      }
+      catch ( ... )
+      {
+        // Nobody else resets the flag while the strand is not in the pool.
+        self->data( []( Data & data ){ data.scheduled = false; } );
+        throw;
+      }
+    }
+
+    /// Runs up to @c maxBatchSize pending tasks and reschedules the strand,
+    /// if there are more.
+    ///
+    /// Only one batch of a strand runs at a time, so the batch buffer can
+    /// be reused without locking.
+    static void runBatch( const std::shared_ptr<Impl> & self,
+                          WorkerData &... workerData )
+    {
+      auto & batch = self->batch;
+      self->data( [&]( Data & data )
+      {
+        const auto n = std::min( data.pending.size(), self->maxBatchSize );
+        std::move( data.pending.begin(), data.pending.begin() + n,
+                   std::back_inserter( batch ) );
+        data.pending.erase( data.pending.begin(), data.pending.begin() + n );
+      } );
+      for ( auto & task : batch )
+        task( workerData... );
+      batch.clear();
+
+      const auto hasMore = self->data( []( Data & data )
+      {
+        data.scheduled = !data.pending.empty();
+        return data.scheduled;
+      } );
+      if ( hasMore )
+        schedule( self );
+    }
+
+    Pool & pool;
+    const std::size_t maxBatchSize;
+    Monitor<Data> data;
+    std::vector<Task> batch;
+  };
+
+  std::shared_ptr<Impl> impl;
+};
+
+} // namespace cu
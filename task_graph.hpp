@@ -0,0 +1,460 @@
+/** @file Defines the class @c TaskGraph.
+ * @author Ralph Tandetzky
+ */
+
+#pragma once
+
+#include "functors.hpp"
+#include "monitor.hpp"
+#include "slice.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace cu
+{
+
+/// Selects the order in which a @c TaskGraph runs the tasks which are ready.
+enum class TaskGraphScheduling
+{
+  /// Tasks are posted to the executor in the order they become ready.
+  fifo,
+  /// Among the ready tasks, the one with the longest remaining critical
+  /// path runs first. The path lengths are computed from the costs passed
+  /// to @c TaskGraph::add().
+  criticalPath,
+  /// Like @c criticalPath, but the costs are learned from the measured run
+  /// times of previous runs. The costs passed to @c TaskGraph::add() are the
+  /// estimates for the first run.
+  measuredCriticalPath
+};
+
+/// A graph of tasks which is built once and executed many times.
+///
+/// Tasks are added together with the ids of the tasks they depend on, just
+/// like with @c DependencyThreadPool. Since a task can only depend on tasks
+/// which have been added before, cyclic dependencies are impossible by
+/// design. Before the first run the graph is compiled into flat arrays of
+/// successors and dependency counts. Each run resets the counters and
+/// posts the tasks to an executor as soon as their dependencies have been
+/// finished. A run allocates no memory in the graph and its cost is
+/// proportional to the number of tasks and dependencies.
+///
+/// By default ready tasks are posted in FIFO order. With the scheduling
+/// @c TaskGraphScheduling::criticalPath the graph keeps the ready tasks in a
+/// heap ordered by the length of their remaining critical path, i.e. their
+/// own cost plus the longest chain of costs of the tasks depending on them.
+/// For every ready task the executor gets a task which runs the best ready
+/// task at the time it is executed. This keeps the long chains going and
+/// avoids idle workers at the end of a run.
+///
+/// Only one run of a graph can be in progress at a time. If a task throws,
+/// then the tasks which have not been started yet are skipped and the
+/// exception is rethrown by @c Completion::wait().
+///
+/// The template type arguments are the worker data of the executor, which
+/// are passed to the tasks like in @c TaskQueueThreadPool.
+///
+/// @example
+///   @code
+///     cu::TaskGraph<> graph;
+///     const auto load   = graph.add( {}, []{ load(); } );
+///     const auto left   = graph.add( { load }, []{ processLeft(); } );
+///     const auto right  = graph.add( { load }, []{ processRight(); } );
+///     graph.add( { left, right }, []{ store(); } );
+///     for ( auto & frame : frames )
+///       graph.run( pool ).wait();
+///   @endcode
+template <typename ...Args>
+class TaskGraph
+{
+public:
+  using NodeId = std::uint32_t;
+
+  /// Designates a run of a task graph.
+  ///
+  /// The handle refers to the graph. It is valid until the next run of the
+  /// graph is started.
+  class Completion
+  {
+  public:
+    /// Returns @c true, if all tasks of the run have been finished or
+    /// skipped.
+    bool isDone() const
+    {
+      return graph->state( []( const State & state ){ return !state.running; } );
+    }
+
+    /// Blocks until the run is done.
+    ///
+    /// @throws the first exception which escaped a task of the run.
+    void wait() const
+    {
+      graph->waitUntilDone();
+      if ( graph->error )
+        std::rethrow_exception( graph->error );
+    }
+
+  private:
+    friend class TaskGraph;
+
+    explicit Completion( const TaskGraph & graph_ ) noexcept
+      : graph( &graph_ )
+    {}
+
+    const TaskGraph * graph;
+  };
+
+  explicit TaskGraph( TaskGraphScheduling scheduling_ = TaskGraphScheduling::fifo )
+    : scheduling( scheduling_ )
+  {}
+
+  TaskGraph( const TaskGraph & ) = delete;
+  TaskGraph & operator=( const TaskGraph & ) = delete;
+
+  /// Blocks until a run in progress is done.
+  ~TaskGraph()
+  {
+    waitUntilDone();
+  }
+
+  /// Adds a task which is executed after the tasks @c dependencies.
+  ///
+  /// This must not be called while the graph runs.
+  ///
+  /// @param cost The estimated run time of the task in microseconds. It is
+  /// only used for critical path scheduling.
+  /// @returns the id of the new task. It can be used as dependency of
+  /// tasks added later.
+  /// @throws std::invalid_argument, if a dependency is not the id of a
+  /// task of this graph.
+  template <typename F>
+  NodeId add( const Slice<const NodeId> dependencies, F && f, double cost = 1 )
+  {
+    assert( !isRunning() );
+    const auto id = static_cast<NodeId>( tasks.size() );
+    for ( auto dependency : dependencies )
+      if ( dependency >= id )
+        throw std::invalid_argument( "Invalid dependency of a task graph node." );
+    // Reserving first keeps the graph consistent, if an allocation fails.
+    costs.reserve( tasks.size() + 1 );
+    predecessors.reserve( predecessors.size() + dependencies.size() );
+    predecessorOffsets.reserve( predecessorOffsets.size() + 1 );
+    tasks.emplace_back( std::forward<F>(f) );
+    costs.push_back( cost );
+    predecessors.insert( predecessors.end(),
+                         dependencies.begin(), dependencies.end() );
+    predecessorOffsets.push_back( predecessors.size() );
+    return id;
+  }
+
+  /// Adds a task without dependencies.
+  template <typename F>
+  NodeId add( F && f )
+  {
+    return add( {}, std::forward<F>(f) );
+  }
+
+  /// Returns the number of tasks.
+  std::size_t size() const noexcept
+  {
+    return tasks.size();
+  }
+
+  /// Starts a run of all tasks on the @c executor.
+  ///
+  /// The @c executor must provide a @c post() member function like
+  /// @c TaskQueueThreadPool and must outlive the run.
+  ///
+  /// @returns a handle to wait for the run.
+  /// @throws std::logic_error, if the graph is already running.
+  template <typename Executor>
+  Completion run( Executor & executor )
+  {
+    state( []( State & state )
+    {
+      if ( state.running )
+        throw std::logic_error( "The task graph is already running." );
+      state.running = true;
+    } );
+    try
+    {
+      compile();
+    }
+    catch ( ... )
+    {
+      finish();
+      throw;
+    }
+
+    const auto n = static_cast<NodeId>( tasks.size() );
+    error = nullptr;
+    failed.store( false, std::memory_order_relaxed );
+    nRemaining.store( n, std::memory_order_relaxed );
+    for ( NodeId i = 0; i < n; ++i )
+      nOpenDependencies[i].store( predecessorOffsets[i+1] - predecessorOffsets[i],
+                                  std::memory_order_relaxed );
+    if ( scheduling == TaskGraphScheduling::fifo )
+    {
+      postTask = [this, &executor]( NodeId id )
+      {
+        executor.post( [this, id]( Args &... args ){ execute( id, args... ); } );
+      };
+    }
+    else
+    {
+      if ( scheduling == TaskGraphScheduling::measuredCriticalPath )
+        learnCosts();
+      computeCriticalPaths();
+      postTask = [this, &executor]( NodeId )
+      {
+        executor.post( [this]( Args &... args ){ execute( popReady(), args... ); } );
+      };
+    }
+    if ( n == 0 )
+      finish();
+    // All roots are in the heap before the first one is posted. Otherwise a
+    // worker might pick a root with a short critical path.
+    if ( scheduling != TaskGraphScheduling::fifo )
+      for ( auto root : roots )
+        pushReady( root );
+    for ( auto root : roots )
+      post( root );
+    return Completion( *this );
+  }
+
+private:
+  struct State
+  {
+    bool running = false;
+    mutable std::condition_variable condition;
+  };
+
+  bool isRunning() const
+  {
+    return state( []( const State & state ){ return state.running; } );
+  }
+
+  void waitUntilDone() const
+  {
+    state( PassUniqueLockTag(), []( const State & state, std::unique_lock<std::mutex> & lock )
+    {
+      state.condition.wait( lock, [&]{ return !state.running; } );
+    } );
+  }
+
+  /// Computes the successors and the roots, if tasks have been added since
+  /// the last compilation.
+  void compile()
+  {
+    const auto n = tasks.size();
+    if ( compiledSize == n )
+      return;
+    successorOffsets.assign( n + 1, 0 );
+    for ( auto predecessor : predecessors )
+      ++successorOffsets[predecessor + 1];
+    for ( std::size_t i = 0; i < n; ++i )
+      successorOffsets[i+1] += successorOffsets[i];
+    successors.resize( predecessors.size() );
+    auto positions = successorOffsets;
+    roots.clear();
+    for ( std::size_t i = 0; i < n; ++i )
+    {
+      if ( predecessorOffsets[i] == predecessorOffsets[i+1] )
+        roots.push_back( static_cast<NodeId>( i ) );
+      for ( auto k = predecessorOffsets[i]; k < predecessorOffsets[i+1]; ++k )
+        successors[positions[predecessors[k]]++] = static_cast<NodeId>( i );
+    }
+    nOpenDependencies = std::make_unique<std::atomic<std::size_t>[]>( n );
+    if ( scheduling != TaskGraphScheduling::fifo )
+    {
+      criticalPaths.resize( n );
+      measuredCosts.resize( n, -1 );
+      ready( [n]( std::vector<NodeId> & ready ){ ready.reserve( n ); } );
+    }
+    compiledSize = n;
+  }
+
+  /// Replaces the cost estimates by an exponential moving average of the
+  /// measured run times.
+  void learnCosts() noexcept
+  {
+    for ( std::size_t i = 0; i < costs.size(); ++i )
+    {
+      if ( measuredCosts[i] < 0 )
+        continue;
+      costs[i] += ( measuredCosts[i] - costs[i] ) / 4;
+      measuredCosts[i] = -1;
+    }
+  }
+
+  /// Computes the length of the longest path of costs from each task to
+  /// the end of the graph.
+  ///
+  /// Since tasks only depend on tasks added before, the reverse order of
+  /// the ids is a topological order.
+  void computeCriticalPaths() noexcept
+  {
+    for ( auto i = costs.size(); i-- > 0; )
+    {
+      double longestSuccessorPath = 0;
+      for ( auto k = successorOffsets[i]; k < successorOffsets[i+1]; ++k )
+        longestSuccessorPath =
+            std::max( longestSuccessorPath, criticalPaths[successors[k]] );
+      criticalPaths[i] = costs[i] + longestSuccessorPath;
+    }
+  }
+
+  bool hasShorterCriticalPath( NodeId lhs, NodeId rhs ) const noexcept
+  {
+    return criticalPaths[lhs] < criticalPaths[rhs];
+  }
+
+  /// Adds a task to the heap of ready tasks. The capacity suffices for all
+  /// tasks, so this never allocates.
+  void pushReady( NodeId id ) noexcept
+  {
+    ready( [&]( std::vector<NodeId> & ready )
+    {
+      ready.push_back( id );
+      std::push_heap( ready.begin(), ready.end(),
+                      [this]( NodeId lhs, NodeId rhs )
+      {
+        return hasShorterCriticalPath( lhs, rhs );
+      } );
+    } );
+  }
+
+  /// Removes the ready task with the longest critical path from the heap.
+  NodeId popReady() noexcept
+  {
+    return ready( [&]( std::vector<NodeId> & ready )
+    {
+      assert( !ready.empty() );
+      std::pop_heap( ready.begin(), ready.end(),
+                     [this]( NodeId lhs, NodeId rhs )
+      {
+        return hasShorterCriticalPath( lhs, rhs );
+      } );
+      const auto id = ready.back();
+      ready.pop_back();
+      return id;
+    } );
+  }
+
+  /// Schedules a task whose dependencies have been finished.
+  void schedule( NodeId id ) noexcept
+  {
+    if ( scheduling != TaskGraphScheduling::fifo )
+      pushReady( id );
+    post( id );
+  }
+
+  /// Posts a task to the executor. With critical path scheduling the posted
+  /// task runs the best ready task at the time it is executed.
+  ///
+  /// If posting fails, then the run fails and a task is skipped. With
+  /// critical path scheduling this is the best ready task.
+  void post( NodeId id ) noexcept
+  {
+    try
+    {
+      postTask( id );
+    }
+    catch ( ... )
+    {
+      fail( std::current_exception() );
+      complete( scheduling == TaskGraphScheduling::fifo ? id : popReady() );
+    }
+  }
+
+  void execute( NodeId id, Args &... args ) noexcept
+  {
+    if ( !failed.load( std::memory_order_relaxed ) )
+    {
+      try
+      {
+        if ( scheduling == TaskGraphScheduling::measuredCriticalPath )
+        {
+          const auto start = std::chrono::steady_clock::now();
+          tasks[id]( args... );
+          measuredCosts[id] = std::chrono::duration<double, std::micro>(
+                std::chrono::steady_clock::now() - start ).count();
+        }
+        else
+          tasks[id]( args... );
+      }
+      catch ( ... )
+      {
+        fail( std::current_exception() );
+      }
+    }
+    complete( id );
+  }
+
+  /// Records the first exception of a run.
+  void fail( std::exception_ptr exception ) noexcept
+  {
+    if ( !failed.exchange( true, std::memory_order_acq_rel ) )
+      error = std::move(exception);
+  }
+
+  /// Schedules the successors which became ready and finishes the run
+  /// after the last task.
+  void complete( NodeId id ) noexcept
+  {
+    for ( auto k = successorOffsets[id]; k < successorOffsets[id+1]; ++k )
+    {
+      const auto successor = successors[k];
+      if ( nOpenDependencies[successor].fetch_sub(
+             1, std::memory_order_acq_rel ) == 1 )
+        schedule( successor );
+    }
+    if ( nRemaining.fetch_sub( 1, std::memory_order_acq_rel ) == 1 )
+      finish();
+  }
+
+  void finish() noexcept
+  {
+    state( []( State & state )
+    {
+      state.running = false;
+      state.condition.notify_all();
+    } );
+  }
+
+  // the graph
+  const TaskGraphScheduling scheduling;
+  std::vector<MoveFunction<void(Args&...)>> tasks;
+  std::vector<double> costs;
+  std::vector<NodeId> predecessors;
+  std::vector<std::size_t> predecessorOffsets{0};
+
+  // the compiled graph
+  std::size_t compiledSize = 0;
+  std::vector<std::size_t> successorOffsets{0};
+  std::vector<NodeId> successors;
+  std::vector<NodeId> roots;
+  std::vector<double> criticalPaths;
+
+  // the state of a run
+  std::unique_ptr<std::atomic<std::size_t>[]> nOpenDependencies;
+  std::atomic<std::size_t> nRemaining{0};
+  std::atomic<bool> failed{false};
+  std::exception_ptr error;
+  std::vector<double> measuredCosts;
+  Monitor<std::vector<NodeId>> ready;
+  MoveFunction<void(NodeId)> postTask;
+  Monitor<State> state;
+};
+
+} // namespace cu
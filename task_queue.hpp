@@ -1,17 +1,75 @@
-/** @file Defines the class @c TaskQueueWithArgs.
+/** @file Defines the class @c GenericTaskQueue and the class
+ * @c TaskQueueWithArgs.
  * @author Ralph Tandetzky
  */
 
 #pragma once
 
 #include "concurrent_queue.hpp"
+#include "exception_handling.hpp"
+#include "functors.hpp"
+#include "priority_concurrent_queue.hpp"
+#include "tracing.hpp"
 #include <future>
 #include <memory>
 #include <type_traits>
+#include <utility>
 
 namespace cu
 {
 
+namespace detail
+{
+  /// Wraps @c f into a type-erased @c std::packaged_task and returns it
+  /// together with the future for the result.
+  template <typename ...Args,
+            typename F>
+  auto makePackagedTask( F && f )
+  {
+    using Result = std::result_of_t<F(Args...)>;
+#if !defined(_MSC_VER)
+    auto task = std::packaged_task<Result(Args&&...)>( std::forward<F>(f) );
+    auto future = task.get_future();
+    return std::make_pair(
+          std::packaged_task<void(Args&&...)>( std::move(task) ),
+          std::move(future) );
+#else
+    // This is a work-around, since MSVC is not standard compliant.
+    // MSVC does not allow move-only functors to be passed to a
+    // packaged_task constructor except the move constructor.
+    // Since packaged_task is move-only by itself, packaged_tasks with
+    // different template arguments cannot be passed into each others
+    // constructors.
+    auto fPtr = std::make_shared<F>( std::forward<F>(f) );
+    auto task = std::make_shared<std::packaged_task<Result(Args&&...)>>(
+          [fPtr]( Args &&... args ){ return (*fPtr)( std::forward<Args>(args)... ); } );
+    auto future = task->get_future();
+    return std::make_pair(
+          std::packaged_task<void(Args&&...)>(
+            [task]( Args &&... args )
+            {
+                (*task)( std::forward<Args>(args)... );
+            } ),
+          std::move(future) );
+#endif
+  }
+
+  /// Wraps @c f into a functor which passes all exceptions escaping @c f
+  /// to @c cu::handleException().
+  template <typename ...Args,
+            typename F>
+  auto makeExceptionHandlingTask( F && f )
+  {
+    return [f = std::decay_t<F>( std::forward<F>(f) )]( Args &&... args ) mutable
+    {
+      CU_HANDLE_ALL_EXCEPTIONS_FROM
+      {
+        f( std::forward<Args>(args)... );
+      };
+    };
+  }
+} // namespace detail
+
 /// A high-performance concurrent queue for functors.
 ///
 /// This class is suitable as a task queue for an event loop of a thread
@@ -25,40 +83,79 @@ namespace cu
 /// to the data of a worker thread as additional argument to the tasks for
 /// optimization purposes.
 /// This technique can be used to cache data in a worker thread, for example.
-template <typename ...Args>
-class TaskQueueWithArgs
+///
+/// The template template parameter @c Queue selects the queue which stores
+/// the tasks. It must provide the member functions @c emplace() and @c pop()
+/// like @c ConcurrentQueue does. Most of the time, the class
+/// @c TaskQueueWithArgs is used which selects @c ConcurrentQueue.
+/// For very high task rates @c BoundedConcurrentQueue may be used instead,
+/// which neither allocates nor locks, but blocks producers while it is full.
+/// With @c PriorityConcurrentQueue tasks can be pushed into priority lanes.
+/// Constructor arguments are forwarded to the queue.
+///
+/// Tasks whose result is not needed should be added with @c post() rather
+/// than @c push(). This stores the functor directly in the queue and avoids
+/// the allocation and synchronization of the shared state of a
+/// @c std::future.
+template <template <typename> class Queue,
+          typename ...Args>
+class GenericTaskQueue
 {
 public:
+  /// Forwards all arguments to the constructor of the underlying queue.
+  template <typename ...QueueArgs>
+  explicit GenericTaskQueue( QueueArgs &&... queueArgs )
+    : tasks( std::forward<QueueArgs>(queueArgs)... )
+  {}
+
   /// Puts a task into the queue.
   ///
   /// @returns a future for the result of the functor.
   template <typename F>
   auto push( F && f )
   {
-#if !defined(_MSC_VER)
-    auto task = std::packaged_task<std::result_of_t<F(Args...)>(Args&&...)>(
-          std::forward<F>(f) );
-    auto result = task.get_future();
-    tasks.emplace( std::move(task) );
-    return result;
-#else
-    // This is a work-around, since MSVC is not standard compliant.
-    // MSVC does not allow move-only functors to be passed to a
-    // packaged_task constructor except the move constructor.
-    // Since packaged_task is move-only by itself, packaged_tasks with
-    // different template arguments cannot be passed into each others
-    // constructors.
-    auto fPtr = std::make_shared<F>( std::forward<F>(f) );
-    auto task = std::make_shared<std::packaged_task<std::result_of_t<F(Args...)>(Args&&...)>>(
-          [fPtr]( Args &&... args ){ return (*fPtr)( std::forward<Args>(args)... ); } );
-    auto result = task->get_future();
-    tasks.emplace(
-          [task]( Args &&... args )
-          {
-              (*task)( std::forward<Args>(args)... );
-          } );
-    return result;
-#endif
+    return pushImpl( std::forward<F>(f), [this]( auto && task )
+    {
+      tasks.emplace( std::move(task) );
+    } );
+  }
+
+  /// Puts a task into the lane of the queue selected by @c priority.
+  ///
+  /// This is only available, if the queue backend has priority lanes, as
+  /// @c PriorityConcurrentQueue does.
+  ///
+  /// @returns a future for the result of the functor.
+  template <typename F>
+  auto push( TaskPriority priority, F && f )
+  {
+    return pushImpl( std::forward<F>(f), [this, priority]( auto && task )
+    {
+      tasks.emplaceWithPriority( priority, std::move(task) );
+    } );
+  }
+
+  /// Puts a task into the queue without creating a future.
+  ///
+  /// Exceptions escaping the task are passed to @c cu::handleException().
+  template <typename F>
+  void post( F && f )
+  {
+    tasks.emplace( detail::makeExceptionHandlingTask<Args...>(
+                     detail::makeTracedTask( "TaskQueue", std::forward<F>(f) ) ) );
+  }
+
+  /// Puts a task into the lane of the queue selected by @c priority without
+  /// creating a future.
+  ///
+  /// Exceptions escaping the task are passed to @c cu::handleException().
+  template <typename F>
+  void post( TaskPriority priority, F && f )
+  {
+    tasks.emplaceWithPriority(
+          priority,
+          detail::makeExceptionHandlingTask<Args...>(
+            detail::makeTracedTask( "TaskQueue", std::forward<F>(f) ) ) );
   }
 
   /// Pops the oldest element in the queue in a blocking way and executes it.
@@ -67,8 +164,36 @@ public:
     tasks.pop()( std::forward<Args>(args)... );
   }
 
+  /// Returns the number of nodes the underlying queue has allocated so far.
+  ///
+  /// This is only available, if the queue backend provides this
+  /// statistic, as @c ConcurrentQueue does.
+  std::size_t nodeAllocationCount() const
+  {
+    return tasks.nodeAllocationCount();
+  }
+
 private:
-  ConcurrentQueue<std::packaged_task<void(Args&&...)>> tasks;
+  template <typename F,
+            typename Emplace>
+  auto pushImpl( F && f, Emplace emplace )
+  {
+    auto taskAndFuture = detail::makePackagedTask<Args...>(
+          detail::makeTracedTask( "TaskQueue", std::forward<F>(f) ) );
+    emplace( std::move(taskAndFuture.first) );
+    return std::move(taskAndFuture.second);
+  }
+
+  Queue<MoveFunction<void(Args&&...)>> tasks;
+};
+
+/// A @c GenericTaskQueue which stores its tasks in a @c ConcurrentQueue.
+template <typename ...Args>
+class TaskQueueWithArgs
+    : public GenericTaskQueue<ConcurrentQueue, Args...>
+{
+public:
+  using GenericTaskQueue<ConcurrentQueue, Args...>::GenericTaskQueue;
 };
 
 using TaskQueue = TaskQueueWithArgs<>;
@@ -1,18 +1,30 @@
-/** @file Defines the class template @c GenericTaskQueueThread.
+/** @file Defines the class templates @c BasicTaskQueueThread and
+ * @c GenericTaskQueueThread and its aliases.
  * @author Ralph Tandetzky
  */
 
 #pragma once
 
 #include "c++17_features.hpp"
+#include "coroutine.hpp"
+#include "rank.hpp"
+#include "spsc_queue.hpp"
 #include "task_queue.hpp"
 
+#include <cstddef>
 #include <thread>
 #include <tuple>
 
 namespace cu
 {
 
+/// Passes the capacity of the task queue to the constructor of a
+/// @c BasicTaskQueueThread, whose queue has a fixed capacity.
+struct TaskQueueCapacity
+{
+  std::size_t value;
+};
+
 namespace detail
 {
   template <typename ...WorkerData>
@@ -43,7 +55,9 @@ namespace detail
     struct {} workerData;
   };
 
-  template <bool hasExternalQueue, typename ...WorkerData>
+  template <template <typename> class Queue,
+            bool hasExternalQueue,
+            typename ...WorkerData>
   struct GenericTaskQueueThreadData
       : WorkerDataImpl<WorkerData...>
   {
@@ -53,20 +67,30 @@ namespace detail
   public:
     using Base::Base;
 
-    TaskQueueWithArgs<WorkerData&...> queue;
+    template <typename ...Args>
+    explicit GenericTaskQueueThreadData(
+        TaskQueueCapacity capacity,
+        Args &&... args
+        )
+      : Base( std::forward<Args>(args)... )
+      , queue( capacity.value )
+    {}
+
+    GenericTaskQueue<Queue, WorkerData&...> queue;
     bool done = false;
   };
 
-  template <typename ...WorkerData>
-  struct GenericTaskQueueThreadData<true,WorkerData...>
+  template <template <typename> class Queue,
+            typename ...WorkerData>
+  struct GenericTaskQueueThreadData<Queue,true,WorkerData...>
       : WorkerDataImpl<WorkerData...>
   {
-    TaskQueueWithArgs<WorkerData&...> & queue;
+    GenericTaskQueue<Queue, WorkerData&...> & queue;
     std::atomic<bool> & done;
 
     template <typename ...Args>
     explicit GenericTaskQueueThreadData(
-        TaskQueueWithArgs<WorkerData&...> & queue_,
+        GenericTaskQueue<Queue, WorkerData&...> & queue_,
         std::atomic<bool> & done_,
         Args &&... args
         )
@@ -75,6 +99,30 @@ namespace detail
       , done(done_)
     {}
   };
+
+  /// Calls @c f with the elements of the worker data as arguments.
+  ///
+  /// The rank must be @c cu::Rank<sizeof...(WorkerData)>.
+  template <typename F,
+            typename Arg>
+  void applyWorkerData( F && f, Arg && workerData, cu::Rank<2> )
+  {
+    cu::apply( std::forward<F>(f), std::forward<Arg>(workerData) );
+  }
+
+  template <typename F,
+            typename Arg>
+  void applyWorkerData( F && f, Arg && workerData, cu::Rank<1> )
+  {
+    std::forward<F>(f)( std::forward<Arg>(workerData) );
+  }
+
+  template <typename F,
+            typename Arg>
+  void applyWorkerData( F && f, Arg &&, cu::Rank<0> )
+  {
+    std::forward<F>(f)();
+  }
 } // namespace detail
 
 /// A task dispatching thread class.
@@ -89,6 +137,9 @@ namespace detail
 /// data that is associated with the worker thread to the tasks.
 /// This can be used to optimize execution by caching data, for example.
 ///
+/// The template template parameter @c Queue selects the queue backend of
+/// the @c GenericTaskQueue, see there.
+///
 /// Most of the time, the alias @c TaskQueueThread for
 /// @c GenericTaskQueueThread<false> is used.
 /// The @c TaskQueueThread contains its own @c TaskQueue.
@@ -97,43 +148,30 @@ namespace detail
 /// @c ExternalTaskQueueThread can be used, which is an alias
 /// for @c GenericTaskQueueThread<true>. You may consider to use
 /// @c TaskQueueThreadPool for convenience in this case.
-template <bool hasExternalTaskQueue,
+///
+/// If tasks are only ever pushed from one thread, then
+/// @c SpscTaskQueueThread may be used. It is backed by a @c SpscQueue
+/// which avoids locks and allocations for the queue. Note that the
+/// destructor pushes a task as well, so it must be called from the
+/// producer thread too.
+template <template <typename> class Queue,
+          bool hasExternalTaskQueue,
           typename ...WorkerData>
-class GenericTaskQueueThread
-    : private detail::GenericTaskQueueThreadData<hasExternalTaskQueue, WorkerData...>
+class BasicTaskQueueThread
+    : private detail::GenericTaskQueueThreadData<Queue, hasExternalTaskQueue, WorkerData...>
 {
 private:
-  using Base = detail::GenericTaskQueueThreadData<hasExternalTaskQueue, WorkerData...>;
+  using Base = detail::GenericTaskQueueThreadData<Queue, hasExternalTaskQueue, WorkerData...>;
   std::thread worker;
 
-  template <typename F,
-            typename Arg>
-  static void apply( F && f, Arg && workerData, cu::Rank<2> )
-  {
-    cu::apply( std::forward<F>(f), std::forward<Arg>(workerData) );
-  }
-
-  template <typename F,
-            typename Arg>
-  static void apply( F && f, Arg && workerData, cu::Rank<1> )
-  {
-    std::forward<F>(f)( std::forward<Arg>(workerData) );
-  }
-
-  template <typename F,
-            typename Arg>
-  static void apply( F && f, Arg &&, cu::Rank<0> )
-  {
-    std::forward<F>(f)();
-  }
-
   void startWorker()
   {
     worker = std::thread( [this]()
     {
+      setTraceThreadName( "TaskQueueThread" );
       while (!this->done)
       {
-        apply( [&](auto&&...args)
+        detail::applyWorkerData( [&](auto&&...args)
           {
             this->queue.popAndExecute( std::forward<decltype(args)>(args)... );
           },
@@ -156,11 +194,13 @@ public:
   /// If @c sizeof...(WorkerData)>=2, then the number of arguments should
   /// coincide with it and each arguments will be forwarded to its respective
   /// worker data item.
+  /// A @c TaskQueueCapacity may be passed in front of these arguments.
+  /// It is forwarded to the constructor of the task queue.
   template <typename ...Args,
             bool B = hasExternalTaskQueue,
             typename = typename std::enable_if_t<
               !B && B == hasExternalTaskQueue>>
-  explicit GenericTaskQueueThread(
+  explicit BasicTaskQueueThread(
       Args &&... args
       )
     : Base( std::forward<Args>(args)... )
@@ -176,8 +216,8 @@ public:
   template <typename ...Args,
             bool B = hasExternalTaskQueue,
             typename = typename std::enable_if_t<B && B == hasExternalTaskQueue>>
-  explicit GenericTaskQueueThread(
-      TaskQueueWithArgs<WorkerData&...> & queue
+  explicit BasicTaskQueueThread(
+      GenericTaskQueue<Queue, WorkerData&...> & queue
     , std::atomic<bool> & done
     , Args &&... args
       )
@@ -200,16 +240,81 @@ public:
     return this->queue.push( std::forward<F>(f) );
   }
 
+  /// Adds a task to the event queue without creating a future.
+  ///
+  /// Exceptions escaping the task are passed to @c cu::handleException().
+  template <typename F>
+  void post( F && f )
+  {
+    this->queue.post( std::forward<F>(f) );
+  }
+
+#ifdef CU_HAS_COROUTINES
+  /// Returns an awaitable which resumes the awaiting coroutine in a task of
+  /// this thread.
+  ///
+  /// @example
+  ///   @code
+  ///     co_await taskQueueThread.schedule();
+  ///   @endcode
+  auto schedule() noexcept
+  {
+    return cu::schedule( *this );
+  }
+
+  /// Returns an awaitable which calls @c f in a task of this thread and
+  /// resumes the awaiting coroutine in the same task with the result.
+  ///
+  /// Unlike the function call operator, this allocates neither a packaged
+  /// task nor a future.
+  ///
+  /// @example
+  ///   @code
+  ///     const auto value = co_await taskQueueThread.schedule( []{ return compute(); } );
+  ///   @endcode
+  template <typename F>
+  auto schedule( F && f )
+  {
+    return cu::schedule<WorkerData...>( *this, std::forward<F>(f) );
+  }
+#endif
+
   /// Blocks until all tasks in the queue have been dispatched and the
   /// thread has ended its execution.
-  ~GenericTaskQueueThread()
+  ~BasicTaskQueueThread()
   {
-    (*this)([this](WorkerData&...){ this->done = true; });
+    post( [this](WorkerData&...){ this->done = true; } );
     worker.join();
   }
 };
 
+/// A @c BasicTaskQueueThread which stores its tasks in a
+/// @c ConcurrentQueue.
+template <bool hasExternalTaskQueue,
+          typename ...WorkerData>
+class GenericTaskQueueThread
+    : public BasicTaskQueueThread<ConcurrentQueue, hasExternalTaskQueue, WorkerData...>
+{
+public:
+  using BasicTaskQueueThread<ConcurrentQueue, hasExternalTaskQueue, WorkerData...>::BasicTaskQueueThread;
+};
+
 using TaskQueueThread         = GenericTaskQueueThread<false>;
 using ExternalTaskQueueThread = GenericTaskQueueThread<true >;
 
+/// A task queue thread for tasks, which are pushed by a single thread.
+///
+/// See @c BasicTaskQueueThread for details.
+class SpscTaskQueueThread
+    : public BasicTaskQueueThread<SpscQueue, false>
+{
+public:
+  /// Starts the worker thread with a queue for at least @c capacity tasks.
+  ///
+  /// @throws std::length_error if the rounded capacity is not representable.
+  explicit SpscTaskQueueThread( std::size_t capacity = 1024 )
+    : BasicTaskQueueThread( TaskQueueCapacity{ capacity } )
+  {}
+};
+
 } // namespace cu
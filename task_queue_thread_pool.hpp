@@ -4,68 +4,496 @@
 
 #pragma once
 
+#include "c++17_features.hpp"
+#include "coroutine.hpp"
+#include "exception_handling.hpp"
 #include "functors.hpp"
-#include "task_queue_thread.hpp"
+#include "monitor.hpp"
+#include "priority_concurrent_queue.hpp"
+#include "scope_guard.hpp"
+#include "task_queue.hpp"
+#include "thread_affinity.hpp"
+#include "tracing.hpp"
+
 #include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <exception>
+#include <future>
+#include <thread>
+#include <tuple>
 #include <vector>
 
 namespace cu
 {
 
+/// Configures the worker threads of an elastic @c TaskQueueThreadPool.
+struct ElasticPoolOptions
+{
+  /// The number of workers which are kept alive, once they are spawned.
+  std::size_t minWorkers = 0;
+  /// The maximum number of workers. If it is zero, then the number of CPUs
+  /// is used.
+  std::size_t maxWorkers = 0;
+  /// Another worker is spawned, if no worker is idle and more than this
+  /// number of tasks is queued.
+  std::size_t maxQueueDepth = 4;
+  /// Another worker is spawned, if no worker is idle, tasks are queued and
+  /// no task has been dequeued for this duration.
+  std::chrono::microseconds maxWaitTime = std::chrono::milliseconds(1);
+  /// Workers which have been idle for this duration retire, as long as more
+  /// than @c minWorkers workers are running.
+  std::chrono::microseconds idleTimeout = std::chrono::seconds(10);
+  /// Selects on which CPUs the workers run.
+  WorkerPlacement placement = WorkerPlacement::unpinned;
+};
+
+
 /// A task dispatching thread pool class.
 ///
 /// This is like @c TaskQueueThread, but the tasks may be dispatched by
 /// multiple threads concurrently.
 ///
+/// Tasks can be pushed with a @c TaskPriority. Workers always take tasks
+/// from higher priority lanes first. In order to avoid starvation, a
+/// non-empty lower lane is served once after it has been bypassed a
+/// number of times, see @c PriorityConcurrentQueue. Tasks without explicit
+/// priority go into the lane @c TaskPriority::normal.
+///
+/// The workers can be pinned to CPUs or spread over the NUMA nodes of the
+/// machine, see @c WorkerPlacement.
+///
+/// By default, the pool starts a fixed number of workers in its constructor.
+/// A pool constructed with @c ElasticPoolOptions is elastic instead: It
+/// starts without workers and spawns them on demand when tasks are added,
+/// up to a maximum number. Workers which are idle for a while retire again.
+/// This keeps the cost of pools low which are idle most of the time.
+///
 /// @note The @c WorkerData will be assigned to each thread in the thread pool
 /// making the data thread-local in effect (as long as the types aren't
-/// references).
+/// references). Each worker copy-constructs its data from the constructor
+/// arguments on its own thread after its affinity has been set. Hence, memory
+/// allocated by the worker data is first touched on the NUMA node of the
+/// worker. If the worker data cannot be copied, then it is moved from the
+/// constructor arguments instead: The first worker gets the data and the
+/// others get moved-from objects.
 template <typename ...WorkerData>
 class TaskQueueThreadPool
 {
 private:
-  TaskQueueWithArgs<WorkerData&...> queue;
-  std::atomic<bool> done{false};
-  std::vector<
-    std::unique_ptr<
-      GenericTaskQueueThread<
-        true,
-        WorkerData...>>> workers;
+  /// An empty task requests a worker to stop.
+  using Task = MoveFunction<void(WorkerData&...)>;
+  using Clock = std::chrono::steady_clock;
+  /// The number of times in a row an elastic worker is replaced, whose
+  /// worker data could not be created.
+  static constexpr std::size_t maxFailedStarts = 3;
+
+  using Startup = detail::WorkerStartup;
+
+  /// Identifies the pool and the worker data of the current thread.
+  struct CurrentWorker
+  {
+    const TaskQueueThreadPool * pool = nullptr;
+    std::tuple<WorkerData...> * workerData = nullptr;
+  };
+
+  static CurrentWorker & currentWorker()
+  {
+    static thread_local CurrentWorker result;
+    return result;
+  }
+
+  struct Threads
+  {
+    std::vector<std::thread> running;
+    /// Threads of retired workers which still need to be joined.
+    std::vector<std::thread> retired;
+    /// Tells for each element of @c cpuSets, whether a running worker uses
+    /// it.
+    std::vector<bool> usedCpuSets;
+    bool stopping = false;
+  };
 
-  auto computeNWorkers( std::size_t nThreads )
+  const ElasticPoolOptions options;
+  const bool elastic;
+  const std::vector<std::vector<unsigned>> cpuSets;
+  const detail::WorkerDataFactory<WorkerData...> makeWorkerData;
+  PriorityConcurrentQueue<Task> tasks;
+  /// The number of tasks in the queue not counting stop requests.
+  std::atomic<std::size_t> nQueuedTasks{0};
+  std::atomic<std::size_t> nWorkers{0};
+  std::atomic<std::size_t> nIdleWorkers{0};
+  /// The number of elastic workers in a row whose worker data could not
+  /// be created.
+  std::atomic<std::size_t> nFailedStarts{0};
+  std::atomic<Clock::rep> lastDequeueTime{0};
+  Monitor<Threads> threads;
+
+  static std::size_t computeNWorkers(
+      std::size_t nThreads, WorkerPlacement placement )
   {
     if ( nThreads != 0 )
       return nThreads;
 
+    if ( placement != WorkerPlacement::unpinned )
+      return availableCpus().size();
+
     return std::max( std::size_t{1}, std::size_t(std::thread::hardware_concurrency()) );
   }
 
+  static ElasticPoolOptions normalize( ElasticPoolOptions options )
+  {
+    options.maxWorkers = computeNWorkers( options.maxWorkers, options.placement );
+    options.minWorkers = std::min( options.minWorkers, options.maxWorkers );
+    return options;
+  }
+
+  template <typename F>
+  void emplaceTask( TaskPriority priority, F && f )
+  {
+    ++nQueuedTasks;
+    try
+    {
+      tasks.emplaceWithPriority( priority, std::forward<F>(f) );
+    }
+    catch ( ... )
+    {
+      --nQueuedTasks;
+      throw;
+    }
+    if ( elastic )
+      growIfNeeded();
+  }
+
+  template <typename ...Args>
+  friend class DependencyThreadPool;
+
+  /// Adds a task like @c post() does, but without recording trace events.
+  /// This is for executors on top of the pool, which trace their tasks
+  /// themselves.
+  template <typename F>
+  void postUntraced( F && f )
+  {
+    emplaceTask( TaskPriority::normal,
+                 detail::makeExceptionHandlingTask<WorkerData&...>(
+                   std::forward<F>(f) ) );
+  }
+
+  /// Spawns another worker, if there is none or if the workers cannot keep
+  /// up with the queued tasks.
+  ///
+  /// This is checked whenever a task is added or dequeued.
+  void growIfNeeded()
+  {
+    const auto n = nWorkers.load();
+    if ( n != 0 )
+    {
+      if ( n >= options.maxWorkers || nIdleWorkers.load() != 0 )
+        return;
+      const auto nQueued = nQueuedTasks.load();
+      if ( nQueued == 0 )
+        return;
+      const auto waitTime = Clock::duration(
+            Clock::now().time_since_epoch().count() - lastDequeueTime.load() );
+      if ( nQueued <= options.maxQueueDepth &&
+           waitTime <= options.maxWaitTime )
+        return;
+    }
+    threads( [&]( Threads & threads )
+    {
+      // Another thread may have spawned or retired a worker in the meantime.
+      if ( threads.stopping || nWorkers.load() != n )
+        return;
+      spawnWorker( threads, nullptr );
+    } );
+  }
+
+  /// Starts a worker thread. Must be called under the lock of @c threads.
+  ///
+  /// The worker takes the lowest CPU set, which is not used by another
+  /// worker. Its index identifies the worker until it retires.
+  void spawnWorker( Threads & threads, Startup * startup )
+  {
+    // A retired worker which spawns its replacement cannot join itself.
+    for ( auto & thread : threads.retired )
+      if ( thread.get_id() != std::this_thread::get_id() )
+        thread.join();
+    threads.retired.erase(
+          std::remove_if( threads.retired.begin(), threads.retired.end(),
+                          []( const std::thread & thread ){ return !thread.joinable(); } ),
+          threads.retired.end() );
+    auto & used = threads.usedCpuSets;
+    const auto index = static_cast<std::size_t>(
+          std::find( used.begin(), used.end(), false ) - used.begin() );
+    if ( index == used.size() )
+      used.push_back( false );
+    lastDequeueTime.store( Clock::now().time_since_epoch().count() );
+    ++nWorkers;
+    try
+    {
+      threads.running.emplace_back( [this, index, startup]{ run( index, startup ); } );
+    }
+    catch ( ... )
+    {
+      --nWorkers;
+      throw;
+    }
+    used[index] = true;
+  }
+
+  /// Removes the current worker from the pool, unless this would leave
+  /// queued tasks without a worker.
+  ///
+  /// @returns @c true, if the worker has retired.
+  bool tryRetire( std::size_t index )
+  {
+    return threads( [&]( Threads & threads )
+    {
+      if ( threads.stopping || nWorkers.load() <= options.minWorkers )
+        return false;
+      --nWorkers;
+      // A task may have been added, after the queue has been found empty.
+      // Then its producer has either seen this worker or it sees the
+      // decremented worker count and spawns a new worker.
+      if ( nQueuedTasks.load() != 0 )
+      {
+        ++nWorkers;
+        return false;
+      }
+      moveToRetired( threads, index );
+      return true;
+    } );
+  }
+
+  /// Moves the thread of the current worker to the retired threads and
+  /// releases its CPU set. Must be called under the lock of @c threads.
+  static void moveToRetired( Threads & threads, std::size_t index )
+  {
+    const auto it = std::find_if( threads.running.begin(), threads.running.end(),
+      []( const std::thread & thread )
+    {
+      return thread.get_id() == std::this_thread::get_id();
+    } );
+    threads.retired.push_back( std::move(*it) );
+    threads.running.erase( it );
+    threads.usedCpuSets[index] = false;
+  }
+
+  optional<Task> popTask()
+  {
+    if ( !elastic )
+      return tasks.pop();
+    ++nIdleWorkers;
+    auto task = tasks.tryPopFor( options.idleTimeout );
+    --nIdleWorkers;
+    lastDequeueTime.store( Clock::now().time_since_epoch().count() );
+    return task;
+  }
+
+  void run( std::size_t index, Startup * startup )
+  {
+    setCurrentThreadAffinity( cpuSets[index] );
+    setTraceThreadName( "TaskQueueThreadPool worker" );
+    optional<std::tuple<WorkerData...>> workerData;
+    try
+    {
+      workerData.emplace( makeWorkerData() );
+    }
+    catch ( ... )
+    {
+      if ( startup )
+        startup->errors[index] = std::current_exception();
+      else
+        handleException();
+    }
+    // After this, the startup data must not be accessed anymore.
+    if ( startup )
+      startup->reportStarted();
+    if ( !workerData )
+    {
+      if ( elastic )
+        threads( [&]( Threads & threads )
+        {
+          if ( threads.stopping )
+            return;
+          --nWorkers;
+          moveToRetired( threads, index );
+          // Otherwise the task which caused the spawn would wait for the
+          // next submission. A factory which keeps failing is not retried
+          // over and over again though.
+          if ( nWorkers.load() != 0 || nQueuedTasks.load() == 0 ||
+               ++nFailedStarts > maxFailedStarts )
+            return;
+          CU_HANDLE_ALL_EXCEPTIONS_FROM
+          {
+            spawnWorker( threads, nullptr );
+          };
+        } );
+      return;
+    }
+    if ( elastic )
+      nFailedStarts.store( 0 );
+
+    currentWorker() = { this, &*workerData };
+    CU_SCOPE_EXIT{ currentWorker() = {}; };
+    for (;;)
+    {
+      auto task = popTask();
+      if ( !task )
+      {
+        if ( tryRetire( index ) )
+          return;
+        continue;
+      }
+      if ( !*task )
+      {
+        // Stop only after all tasks have been dispatched, since the stop
+        // request may have overtaken tasks in higher priority lanes.
+        if ( nQueuedTasks.load() == 0 )
+          return;
+        tasks.emplaceWithPriority( TaskPriority::low, Task{} );
+        continue;
+      }
+      execute( *task, *workerData );
+    }
+  }
+
+  void execute( Task & task, std::tuple<WorkerData...> & workerData )
+  {
+    --nQueuedTasks;
+    if ( elastic )
+      growIfNeeded();
+    cu::apply( task, workerData );
+  }
+
+  /// Blocks the current worker of this pool until @c isReady() returns
+  /// @c true.
+  ///
+  /// Queued tasks are executed while waiting. Only if there are none,
+  /// @c waitBriefly() is called.
+  /// Stop requests are put back into the queue, since the current task
+  /// must be finished first.
+  template <typename IsReady,
+            typename WaitBriefly>
+  void helpUntil( IsReady isReady, WaitBriefly waitBriefly )
+  {
+    const auto current = currentWorker();
+    assert( current.pool == this );
+    while ( !isReady() )
+    {
+      auto task = tasks.tryPopFor( std::chrono::seconds(0) );
+      if ( task && *task )
+      {
+        execute( *task, *current.workerData );
+        continue;
+      }
+      if ( task )
+        tasks.emplaceWithPriority( TaskPriority::low, std::move(*task) );
+      waitBriefly();
+    }
+  }
+
+  /// Lets the workers dispatch all remaining tasks and joins them.
+  void stopWorkers() noexcept
+  {
+    auto stopped = threads( []( Threads & threads )
+    {
+      threads.stopping = true;
+      return std::move(threads);
+    } );
+    for ( std::size_t i = 0; i < stopped.running.size(); ++i )
+      tasks.emplaceWithPriority( TaskPriority::low, Task{} );
+    for ( auto & thread : stopped.running )
+      thread.join();
+    for ( auto & thread : stopped.retired )
+      thread.join();
+  }
+
 public:
+  /// Blocks until all tasks have been dispatched and joins the workers.
   ~TaskQueueThreadPool()
   {
-    done = true;
-    for ( const auto & worker : workers )
-      (void)worker, (*this)( NoOpFunctor{} );
+    stopWorkers();
   }
 
   /// Starts the task dispatching loops of the thread pool.
+  ///
+  /// @param nThreads The number of workers. If it is zero, then the number
+  /// of CPUs is used.
+  /// @param placement Selects on which CPUs the workers run.
+  /// @param workerData The arguments each worker copies its worker data from
+  /// or moves it from, if it is move-only.
   explicit TaskQueueThreadPool(
       std::size_t nThreads,
+      WorkerPlacement placement,
       WorkerData &&... workerData )
+    : options( normalize( ElasticPoolOptions{
+                 nThreads, nThreads, 0, {}, {}, placement } ) )
+    , elastic( false )
+    , cpuSets( computeWorkerCpuSets( placement, options.maxWorkers ) )
+    , makeWorkerData( detail::makeWorkerDataFactory<WorkerData...>(
+                        std::forward<WorkerData>(workerData)... ) )
   {
-    nThreads = computeNWorkers( nThreads );
-    workers.reserve( nThreads );
-    for ( auto i = 0*nThreads; i < nThreads; ++i )
-      workers.push_back(
-            std::make_unique<GenericTaskQueueThread<true,WorkerData...>>(
-              queue, done, std::forward<WorkerData>(workerData)...) );
+    const auto n = options.maxWorkers;
+    Startup startup( n );
+    try
+    {
+      threads( [&]( Threads & threads )
+      {
+        threads.running.reserve( n );
+        for ( auto i = 0*n; i < n; ++i )
+          spawnWorker( threads, &startup );
+      } );
+    }
+    catch ( ... )
+    {
+      startup.waitUntilStarted( nWorkers.load() );
+      stopWorkers();
+      throw;
+    }
+    startup.waitUntilStarted( n );
+
+    for ( const auto & error : startup.errors )
+    {
+      if ( error )
+      {
+        stopWorkers();
+        std::rethrow_exception( error );
+      }
+    }
   }
 
+  explicit TaskQueueThreadPool(
+      std::size_t nThreads,
+      WorkerData &&... workerData )
+    : TaskQueueThreadPool( nThreads, WorkerPlacement::unpinned,
+                           std::forward<WorkerData>(workerData)... )
+  {}
+
   explicit TaskQueueThreadPool(
       WorkerData &&... workerData )
     : TaskQueueThreadPool( 0, std::forward<WorkerData>(workerData)... )
   {}
 
+  /// Creates an elastic thread pool.
+  ///
+  /// No worker is started by the constructor. Workers are spawned when
+  /// tasks are added, see @c ElasticPoolOptions.
+  ///
+  /// If the construction of the worker data throws on a worker thread,
+  /// then the exception is passed to @c cu::handleException() and the
+  /// worker retires.
+  explicit TaskQueueThreadPool(
+      const ElasticPoolOptions & options_,
+      WorkerData &&... workerData )
+    : options( normalize( options_ ) )
+    , elastic( true )
+    , cpuSets( computeWorkerCpuSets( options.placement, options.maxWorkers ) )
+    , makeWorkerData( detail::makeWorkerDataFactory<WorkerData...>(
+                        std::forward<WorkerData>(workerData)... ) )
+  {}
+
   /// Adds a task to the event queue.
   ///
   /// @returns A @c std::future for the result.
@@ -77,7 +505,126 @@ public:
   template <typename F>
   auto operator()( F && f )
   {
-    return queue.push( std::forward<F>(f) );
+    return (*this)( TaskPriority::normal, std::forward<F>(f) );
+  }
+
+  /// Adds a task to the lane of the event queue selected by @c priority.
+  ///
+  /// @returns A @c std::future for the result.
+  ///
+  /// @example A latency critical task is added like this:
+  ///   @code
+  ///     auto result = pool( cu::TaskPriority::high,
+  ///                         [](){ return doSomething(); } );
+  ///   @endcode
+  template <typename F>
+  auto operator()( TaskPriority priority, F && f )
+  {
+    auto taskAndFuture =
+        detail::makePackagedTask<WorkerData&...>(
+          detail::makeTracedTask( "TaskQueueThreadPool", std::forward<F>(f) ) );
+    emplaceTask( priority, std::move(taskAndFuture.first) );
+    return std::move(taskAndFuture.second);
+  }
+
+  /// Adds a task to the event queue without creating a future.
+  ///
+  /// Exceptions escaping the task are passed to @c cu::handleException().
+  template <typename F>
+  void post( F && f )
+  {
+    post( TaskPriority::normal, std::forward<F>(f) );
+  }
+
+  /// Adds a task to the lane of the event queue selected by @c priority
+  /// without creating a future.
+  template <typename F>
+  void post( TaskPriority priority, F && f )
+  {
+    emplaceTask( priority, detail::makeExceptionHandlingTask<WorkerData&...>(
+                   detail::makeTracedTask( "TaskQueueThreadPool",
+                                           std::forward<F>(f) ) ) );
+  }
+
+#ifdef CU_HAS_COROUTINES
+  /// Returns an awaitable which resumes the awaiting coroutine in a task of
+  /// this pool.
+  ///
+  /// @example
+  ///   @code
+  ///     co_await pool.schedule();
+  ///   @endcode
+  auto schedule() noexcept
+  {
+    return cu::schedule( *this );
+  }
+
+  /// Returns an awaitable which calls @c f in a task of this pool and
+  /// resumes the awaiting coroutine in the same task with the result.
+  ///
+  /// Unlike the function call operator, this allocates neither a packaged
+  /// task nor a future.
+  ///
+  /// @example
+  ///   @code
+  ///     const auto value = co_await pool.schedule( []{ return compute(); } );
+  ///   @endcode
+  template <typename F>
+  auto schedule( F && f )
+  {
+    return cu::schedule<WorkerData...>( *this, std::forward<F>(f) );
+  }
+#endif
+
+  /// Blocks until @c future is ready.
+  ///
+  /// If this function is called by a task running on this pool, then the
+  /// worker executes other queued tasks while waiting instead of sleeping.
+  /// This avoids starving or dead-locking the pool, when tasks wait for the
+  /// results of other tasks on the same pool.
+  ///
+  /// @note Tasks are executed on the stack of the waiting task. Hence, deeply
+  /// nested waits need a correspondingly large stack.
+  ///
+  /// @c Future may be a @c std::future or a @c std::shared_future.
+  template <typename Future>
+  void wait( const Future & future )
+  {
+    if ( currentWorker().pool != this )
+      return future.wait();
+    helpUntil(
+      [&]{ return future.wait_for( std::chrono::seconds(0) ) == std::future_status::ready; },
+      [&]{ future.wait_for( std::chrono::microseconds(100) ); } );
+  }
+
+  /// Waits for the @c future like @c wait() and returns its result.
+  ///
+  /// @example A task which runs a subtask on the same pool:
+  ///   @code
+  ///     pool( [&]{
+  ///       auto sub = pool( []{ return computePart(); } );
+  ///       return computeOtherPart() + pool.get( sub );
+  ///     } );
+  ///   @endcode
+  template <typename Future>
+  decltype(auto) get( Future && future )
+  {
+    wait( future );
+    return future.get();
+  }
+
+  /// Returns the number of worker threads.
+  ///
+  /// For an elastic pool this is the maximum number of workers.
+  std::size_t workerCount() const noexcept
+  {
+    return options.maxWorkers;
+  }
+
+  /// Returns the number of worker threads which are currently running.
+  std::size_t activeWorkerCount() const noexcept
+  {
+    return nWorkers.load();
   }
 };
 
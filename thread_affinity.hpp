@@ -0,0 +1,291 @@
+/** @file Defines functions for placing threads on CPUs and NUMA nodes.
+ *
+ * On Linux the affinity syscalls and the NUMA topology in sysfs are used.
+ * On other platforms the topology consists of a single node and setting
+ * the affinity of a thread has no effect.
+ *
+ * The thread pools also share the code here for constructing the worker
+ * data on the workers after their affinity has been set.
+ *
+ * @author Ralph Tandetzky
+ */
+
+#pragma once
+
+#include "functors.hpp"
+#include "monitor.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace cu
+{
+
+/// Selects how the worker threads of a thread pool are placed on the CPUs.
+enum class WorkerPlacement
+{
+  /// The operating system may move the workers freely between CPUs.
+  unpinned,
+  /// Each worker is pinned to a single CPU. The CPUs are assigned in order,
+  /// so neighbouring workers share a NUMA node.
+  pinToCores,
+  /// The workers are distributed round-robin over the NUMA nodes. Each
+  /// worker may run on all CPUs of its node.
+  spreadOverNumaNodes
+};
+
+namespace detail
+{
+  /// Parses a CPU list in the format of the Linux sysfs like "0-3,8,10-11".
+  inline std::vector<unsigned> parseCpuList( const std::string & s )
+  {
+    std::vector<unsigned> result;
+    std::istringstream stream( s );
+    std::string range;
+    while ( std::getline( stream, range, ',' ) )
+    {
+      if ( range.find_first_of( "0123456789" ) == std::string::npos )
+        continue;
+      const auto dash = range.find( '-' );
+      const auto first = static_cast<unsigned>( std::stoul( range.substr( 0, dash ) ) );
+      const auto last = dash == std::string::npos
+          ? first
+          : static_cast<unsigned>( std::stoul( range.substr( dash + 1 ) ) );
+      for ( auto cpu = first; cpu <= last; ++cpu )
+        result.push_back( cpu );
+    }
+    return result;
+  }
+
+  /// Reads the first line of a file or returns an empty string on failure.
+  inline std::string readFirstLine( const std::string & fileName )
+  {
+    std::ifstream file( fileName );
+    std::string line;
+    std::getline( file, line );
+    return line;
+  }
+} // namespace detail
+
+
+/// Returns the CPUs the current process is allowed to run on.
+inline std::vector<unsigned> availableCpus()
+{
+  std::vector<unsigned> result;
+#if defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO( &set );
+  if ( sched_getaffinity( 0, sizeof(set), &set ) == 0 )
+  {
+    for ( unsigned cpu = 0; cpu < CPU_SETSIZE; ++cpu )
+      if ( CPU_ISSET( cpu, &set ) )
+        result.push_back( cpu );
+  }
+#endif
+  if ( result.empty() )
+  {
+    const auto n = std::max( 1u, std::thread::hardware_concurrency() );
+    for ( unsigned cpu = 0; cpu < n; ++cpu )
+      result.push_back( cpu );
+  }
+  return result;
+}
+
+
+/// Returns the available CPUs grouped by NUMA node.
+///
+/// Nodes without available CPUs are omitted. If the topology is unknown,
+/// then all available CPUs form a single node.
+inline std::vector<std::vector<unsigned>> numaNodeCpus()
+{
+  const auto available = availableCpus();
+  std::vector<std::vector<unsigned>> result;
+#if defined(__linux__)
+  const std::string nodeDir = "/sys/devices/system/node/";
+  for ( const auto node : detail::parseCpuList(
+          detail::readFirstLine( nodeDir + "online" ) ) )
+  {
+    auto cpus = detail::parseCpuList( detail::readFirstLine(
+          nodeDir + "node" + std::to_string(node) + "/cpulist" ) );
+    cpus.erase( std::remove_if( cpus.begin(), cpus.end(), [&]( unsigned cpu )
+    {
+      return std::find( available.begin(), available.end(), cpu ) == available.end();
+    } ), cpus.end() );
+    if ( !cpus.empty() )
+      result.push_back( std::move(cpus) );
+  }
+#endif
+  if ( result.empty() )
+    result.push_back( available );
+  return result;
+}
+
+
+/// Returns the set of CPUs for each of @c nWorkers workers according to
+/// @c placement.
+///
+/// For @c WorkerPlacement::unpinned the sets are empty.
+inline std::vector<std::vector<unsigned>> computeWorkerCpuSets(
+    WorkerPlacement placement, std::size_t nWorkers )
+{
+  std::vector<std::vector<unsigned>> result( nWorkers );
+  switch ( placement )
+  {
+  case WorkerPlacement::unpinned:
+    break;
+  case WorkerPlacement::pinToCores:
+  {
+    std::vector<unsigned> cpus;
+    for ( const auto & node : numaNodeCpus() )
+      cpus.insert( cpus.end(), node.begin(), node.end() );
+    for ( std::size_t i = 0; i < nWorkers; ++i )
+      result[i] = { cpus[i % cpus.size()] };
+    break;
+  }
+  case WorkerPlacement::spreadOverNumaNodes:
+  {
+    const auto nodes = numaNodeCpus();
+    for ( std::size_t i = 0; i < nWorkers; ++i )
+      result[i] = nodes[i % nodes.size()];
+    break;
+  }
+  }
+  return result;
+}
+
+
+/// Restricts the current thread to run on the given CPUs.
+///
+/// @returns @c true on success. If @c cpus is empty or the platform does
+/// not support thread affinities, then nothing happens and @c false is
+/// returned.
+inline bool setCurrentThreadAffinity( const std::vector<unsigned> & cpus )
+{
+#if defined(__linux__)
+  if ( cpus.empty() )
+    return false;
+  cpu_set_t set;
+  CPU_ZERO( &set );
+  for ( const auto cpu : cpus )
+    if ( cpu < CPU_SETSIZE )
+      CPU_SET( cpu, &set );
+  return pthread_setaffinity_np( pthread_self(), sizeof(set), &set ) == 0;
+#else
+  (void)cpus;
+  return false;
+#endif
+}
+
+
+namespace detail
+{
+  /// Synchronizes the constructor of a thread pool with the start of its
+  /// workers.
+  class WorkerStartup
+  {
+  public:
+    explicit WorkerStartup( std::size_t nWorkers )
+      : errors( nWorkers )
+    {}
+
+    /// The exceptions thrown by the workers while starting, by index.
+    std::vector<std::exception_ptr> errors;
+
+    /// Is called by each worker as its last access of the startup data.
+    ///
+    /// The counter is guarded by a mutex and the notification happens
+    /// under the lock. Otherwise the constructor might see the last worker
+    /// started and destroy the startup data while it is still being
+    /// notified.
+    void reportStarted()
+    {
+      progress( []( Progress & progress )
+      {
+        ++progress.nStarted;
+        progress.started.notify_all();
+      } );
+    }
+
+    void waitUntilStarted( std::size_t nWorkers )
+    {
+      progress( PassUniqueLockTag(), [&]( Progress & progress, std::unique_lock<std::mutex> & lock )
+      {
+        progress.started.wait( lock, [&]{ return progress.nStarted == nWorkers; } );
+      } );
+    }
+
+  private:
+    struct Progress
+    {
+      std::size_t nStarted = 0;
+      std::condition_variable started;
+    };
+
+    Monitor<Progress> progress;
+  };
+
+  /// Creates the worker data of a thread pool worker on the worker thread.
+  ///
+  /// It is called by the workers concurrently.
+  template <typename ...WorkerData>
+  using WorkerDataFactory = MoveFunction<std::tuple<WorkerData...>() const>;
+
+  template <typename ...WorkerData>
+  WorkerDataFactory<WorkerData...> makeWorkerDataFactoryImpl(
+      std::true_type, WorkerData &&... workerData )
+  {
+    return [prototype = std::tuple<WorkerData...>(
+              std::forward<WorkerData>(workerData)... )]
+    {
+      return prototype;
+    };
+  }
+
+  template <typename ...WorkerData>
+  WorkerDataFactory<WorkerData...> makeWorkerDataFactoryImpl(
+      std::false_type, WorkerData &&... workerData )
+  {
+    const auto source = std::make_shared<Monitor<std::tuple<WorkerData...>>>(
+          std::forward<WorkerData>(workerData)... );
+    return [source]
+    {
+      return (*source)( []( std::tuple<WorkerData...> & data )
+      {
+        return std::move(data);
+      } );
+    };
+  }
+
+  /// Returns a factory, which copies the worker data from the arguments.
+  ///
+  /// If the worker data cannot be copied, then it is moved from the
+  /// arguments instead. Then the first worker gets the data and the others
+  /// get moved-from objects, as if all workers had been constructed from
+  /// the same rvalues.
+  template <typename ...WorkerData>
+  WorkerDataFactory<WorkerData...> makeWorkerDataFactory(
+      WorkerData &&... workerData )
+  {
+    return makeWorkerDataFactoryImpl<WorkerData...>(
+          std::is_copy_constructible<std::tuple<WorkerData...>>{},
+          std::forward<WorkerData>(workerData)... );
+  }
+} // namespace detail
+
+} // namespace cu
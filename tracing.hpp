@@ -0,0 +1,577 @@
+/** @file Defines opt-in execution tracing for the task queues and thread
+ * pools of this library and the export of the traces in the Chrome trace
+ * event format.
+ *
+ * Tracing is compiled in, if the macro @c CU_ENABLE_TRACING is defined
+ * before this header is included, e.g. on the compiler command line.
+ * Otherwise all recording functions are empty and the task wrappers are
+ * the identity, so tracing costs nothing.
+ *
+ * When tracing is enabled, the executors record when a task is enqueued,
+ * when it starts and when it ends, and @c DependencyThreadPool records the
+ * dependencies between its tasks. Each thread writes into a ring buffer of
+ * its own without locking. @c writeChromeTrace() dumps the buffers as JSON
+ * which can be loaded by chrome://tracing or the Perfetto UI.
+ *
+ * The timestamps are taken from @c std::chrono::steady_clock. On x86 the
+ * macro @c CU_TRACE_USE_TSC may be defined in addition to read the time
+ * stamp counter instead, which is cheaper. This is only accurate, if the
+ * counter runs at a constant rate and is synchronized between the cores.
+ *
+ * @author Ralph Tandetzky
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <utility>
+
+#ifdef CU_ENABLE_TRACING
+#include "monitor.hpp"
+#include "scope_guard.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#ifdef CU_TRACE_USE_TSC
+#if defined(_MSC_VER) && ( defined(_M_X64) || defined(_M_IX86) )
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#error "CU_TRACE_USE_TSC requires an x86 processor."
+#endif
+#endif
+#endif
+
+namespace cu
+{
+
+#ifdef CU_ENABLE_TRACING
+
+namespace detail
+{
+  /// Identifies a traced task.
+  using TraceTaskId = std::uint64_t;
+
+  inline std::uint64_t steadyClockNanoseconds() noexcept
+  {
+    return static_cast<std::uint64_t>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch() ).count() );
+  }
+
+  /// Returns a timestamp for a trace event.
+  ///
+  /// If @c CU_TRACE_USE_TSC is defined, then this reads the time stamp
+  /// counter, which is several times cheaper than
+  /// @c std::chrono::steady_clock. The ticks are converted to nanoseconds
+  /// when the trace is written, see @c TraceClock.
+  inline std::uint64_t traceTimestamp() noexcept
+  {
+#ifdef CU_TRACE_USE_TSC
+    return __rdtsc();
+#else
+    return steadyClockNanoseconds();
+#endif
+  }
+
+  /// Converts trace timestamps to nanoseconds since the first trace event.
+  class TraceClock
+  {
+  public:
+    /// Calibrates the clock against @c std::chrono::steady_clock.
+    TraceClock() noexcept
+      : ticksAtStart( start().ticks )
+    {
+#ifdef CU_TRACE_USE_TSC
+      const auto elapsedTicks = traceTimestamp() - start().ticks;
+      const auto elapsedNanoseconds = steadyClockNanoseconds() - start().nanoseconds;
+      if ( elapsedTicks > 0 && elapsedNanoseconds > 0 )
+        nanosecondsPerTick = double(elapsedNanoseconds) / double(elapsedTicks);
+#endif
+    }
+
+    /// Records the reference point. This is called, before the first
+    /// event is recorded.
+    static void init() noexcept
+    {
+      start();
+    }
+
+    std::uint64_t toNanoseconds( std::uint64_t timestamp ) const noexcept
+    {
+      return timestamp < ticksAtStart ? 0 : static_cast<std::uint64_t>(
+            double( timestamp - ticksAtStart ) * nanosecondsPerTick );
+    }
+
+  private:
+    struct Start
+    {
+      std::uint64_t ticks;
+      std::uint64_t nanoseconds;
+    };
+
+    static const Start & start() noexcept
+    {
+      static const Start result{ traceTimestamp(), steadyClockNanoseconds() };
+      return result;
+    }
+
+    std::uint64_t ticksAtStart;
+    double nanosecondsPerTick = 1;
+  };
+
+  enum class TraceEventKind : std::uint64_t
+  {
+    enqueue,
+    begin,
+    end,
+    edge
+  };
+
+  /// An event in a trace buffer.
+  ///
+  /// The words are atomics, so that a buffer can be dumped while its thread
+  /// is still writing. Relaxed atomic stores are plain stores on common
+  /// platforms.
+  struct TraceEvent
+  {
+    std::atomic<std::uint64_t> kind;
+    std::atomic<std::uint64_t> time;
+    std::atomic<std::uint64_t> taskId;
+    /// The name of the executor for begin events and the id of the
+    /// dependency for edge events.
+    std::atomic<std::uint64_t> other;
+  };
+
+  /// The ring buffer of the trace events of one thread.
+  ///
+  /// Only the owning thread writes. When the buffer is full, the oldest
+  /// events are overwritten. When the thread exits, the buffer is kept with
+  /// its events and is reused by the next thread which starts tracing.
+  ///
+  /// The events can be read concurrently like with a sequence lock: The
+  /// write counter is advanced before an event is overwritten, and a
+  /// reader drops the events whose slots the counter has reached after
+  /// they have been copied.
+  class TraceBuffer
+  {
+  public:
+    static constexpr std::size_t capacity = std::size_t{1} << 16;
+
+    explicit TraceBuffer( std::size_t threadIndex_ )
+      : threadIndex( threadIndex_ )
+      , events( new TraceEvent[capacity] )
+    {}
+
+    void record( TraceEventKind kind, TraceTaskId taskId, std::uint64_t other ) noexcept
+    {
+      const auto time = traceTimestamp();
+      const auto n = nWritten.load( std::memory_order_relaxed );
+      auto & event = events[n % capacity];
+      // A reader which sees any of the following stores also sees the
+      // counter value @c n, which tells that this slot is being written.
+      // Without the fence the stores could become visible before the
+      // counter and the reader could return a torn event.
+      std::atomic_thread_fence( std::memory_order_release );
+      event.kind  .store( static_cast<std::uint64_t>( kind ), std::memory_order_relaxed );
+      event.time  .store( time  , std::memory_order_relaxed );
+      event.taskId.store( taskId, std::memory_order_relaxed );
+      event.other .store( other , std::memory_order_relaxed );
+      nWritten.store( n + 1, std::memory_order_release );
+    }
+
+    struct Snapshot
+    {
+      TraceEventKind kind;
+      std::uint64_t time;
+      TraceTaskId taskId;
+      std::uint64_t other;
+    };
+
+    /// Copies the events which are in the buffer.
+    ///
+    /// Events which might have been overwritten during the copy are
+    /// dropped.
+    std::vector<Snapshot> snapshot() const
+    {
+      const auto end = nWritten.load( std::memory_order_acquire );
+      const auto begin = std::max<std::uint64_t>(
+            end > capacity ? end - capacity : 0,
+            nCleared.load( std::memory_order_relaxed ) );
+      std::vector<Snapshot> result;
+      if ( begin >= end )
+        return result;
+      result.reserve( end - begin );
+      for ( auto i = begin; i < end; ++i )
+      {
+        const auto & event = events[i % capacity];
+        result.push_back( {
+          static_cast<TraceEventKind>( event.kind.load( std::memory_order_relaxed ) ),
+          event.time  .load( std::memory_order_relaxed ),
+          event.taskId.load( std::memory_order_relaxed ),
+          event.other .load( std::memory_order_relaxed ) } );
+      }
+      std::atomic_thread_fence( std::memory_order_acquire );
+      // The slot of the event which is being written after the copy might
+      // have been overwritten too.
+      const auto endAfterCopy = nWritten.load( std::memory_order_relaxed ) + 1;
+      if ( endAfterCopy > begin + capacity )
+        result.erase( result.begin(), result.begin() +
+                      std::min<std::size_t>( result.size(),
+                                             endAfterCopy - capacity - begin ) );
+      return result;
+    }
+
+    /// Hides the events recorded so far from @c snapshot(). Unlike
+    /// resetting the write position, this is safe while the owning thread
+    /// records events.
+    void clear() noexcept
+    {
+      nCleared.store( nWritten.load( std::memory_order_acquire ),
+                      std::memory_order_relaxed );
+    }
+
+    const std::size_t threadIndex;
+    Monitor<std::string> threadName;
+    /// Tells whether a thread records into this buffer. It is guarded by
+    /// the lock of @c traceBuffers().
+    bool isInUse = true;
+
+  private:
+    std::unique_ptr<TraceEvent[]> events;
+    std::atomic<std::uint64_t> nWritten{0};
+    std::atomic<std::uint64_t> nCleared{0};
+  };
+
+  using TraceBuffers = std::vector<std::unique_ptr<TraceBuffer>>;
+
+  /// All trace buffers which have ever been created. Buffers outlive their
+  /// threads, so their events can still be dumped.
+  inline Monitor<TraceBuffers> & traceBuffers()
+  {
+    static Monitor<TraceBuffers> result;
+    return result;
+  }
+
+  /// Returns a buffer which is not in use or creates a new one.
+  ///
+  /// Reusing the buffers of threads which have exited bounds the memory
+  /// for pools which spawn and retire their workers over and over.
+  inline TraceBuffer * acquireTraceBuffer()
+  {
+    return traceBuffers()( []( TraceBuffers & buffers )
+    {
+      for ( const auto & buffer : buffers )
+      {
+        if ( !buffer->isInUse )
+        {
+          buffer->isInUse = true;
+          buffer->threadName( []( std::string & name ){ name.clear(); } );
+          return buffer.get();
+        }
+      }
+      buffers.push_back( std::make_unique<TraceBuffer>( buffers.size() ) );
+      return buffers.back().get();
+    } );
+  }
+
+  /// Returns the buffer of a thread for reuse, when the thread exits.
+  class TraceBufferLease
+  {
+  public:
+    explicit TraceBufferLease( TraceBuffer *& buffer_ ) noexcept
+      : buffer( buffer_ )
+    {}
+
+    ~TraceBufferLease()
+    {
+      traceBuffers()( [this]( TraceBuffers & )
+      {
+        buffer->isInUse = false;
+      } );
+      buffer = nullptr;
+    }
+
+  private:
+    TraceBuffer *& buffer;
+  };
+
+  inline TraceBuffer & currentTraceBuffer()
+  {
+    // A plain pointer needs no guard for dynamic initialization, which
+    // keeps the common path cheap. The lease is only touched once.
+    static thread_local TraceBuffer * result = nullptr;
+    if ( !result )
+    {
+      TraceClock::init();
+      result = acquireTraceBuffer();
+      static thread_local TraceBufferLease lease( result );
+    }
+    return *result;
+  }
+
+  inline TraceTaskId newTraceTaskId() noexcept
+  {
+    static std::atomic<TraceTaskId> counter{0};
+    return counter.fetch_add( 1, std::memory_order_relaxed ) + 1;
+  }
+
+  inline void traceEnqueue( TraceTaskId id ) noexcept
+  {
+    currentTraceBuffer().record( TraceEventKind::enqueue, id, 0 );
+  }
+
+  /// Records that the task @c to depends on the task @c from.
+  inline void traceEdge( TraceTaskId from, TraceTaskId to ) noexcept
+  {
+    currentTraceBuffer().record( TraceEventKind::edge, to, from );
+  }
+
+  /// Wraps @c f into a functor which records the start and the end of
+  /// each call.
+  ///
+  /// The enqueue event is not recorded. The caller records it with
+  /// @c traceEnqueue(), when the task is actually queued.
+  ///
+  /// @param name The name of the executor. It must be a string literal.
+  template <typename F>
+  auto makeTracedTask( const char * name, TraceTaskId id, F && f )
+  {
+    return [name, id, f = std::decay_t<F>( std::forward<F>(f) )]
+        ( auto &&... args ) mutable -> decltype(auto)
+    {
+      auto & buffer = currentTraceBuffer();
+      buffer.record( TraceEventKind::begin, id,
+                     reinterpret_cast<std::uintptr_t>( name ) );
+      CU_SCOPE_EXIT
+      {
+        buffer.record( TraceEventKind::end, id, 0 );
+      };
+      return f( std::forward<decltype(args)>(args)... );
+    };
+  }
+
+  /// Like the other overload, but with a new id. The enqueue event is
+  /// recorded right away.
+  template <typename F>
+  auto makeTracedTask( const char * name, F && f )
+  {
+    const auto id = newTraceTaskId();
+    traceEnqueue( id );
+    return makeTracedTask( name, id, std::forward<F>(f) );
+  }
+
+  /// Writes a string as JSON string literal.
+  inline void writeJsonString( std::ostream & os, const std::string & s )
+  {
+    os << '"';
+    for ( const auto c : s )
+    {
+      if ( c == '"' || c == '\\' )
+        os << '\\' << c;
+      else if ( static_cast<unsigned char>(c) < 0x20 )
+        os << ' ';
+      else
+        os << c;
+    }
+    os << '"';
+  }
+} // namespace detail
+
+/// Sets the name of the calling thread in the trace.
+inline void setTraceThreadName( std::string name )
+{
+  detail::currentTraceBuffer().threadName( [&]( std::string & threadName )
+  {
+    threadName = std::move(name);
+  } );
+}
+
+/// Discards all recorded events.
+inline void clearTrace()
+{
+  detail::traceBuffers()( []( detail::TraceBuffers & buffers )
+  {
+    for ( const auto & buffer : buffers )
+      buffer->clear();
+  } );
+}
+
+/// Writes the recorded events in the Chrome trace event format.
+///
+/// Each task becomes a slice on the thread which executed it. Flow arrows
+/// connect the enqueueing of a task with its start and the end of a
+/// dependency with the start of its dependent task.
+///
+/// The buffers can be dumped while tasks are running, but then the events
+/// of tasks which are in progress may be incomplete.
+inline void writeChromeTrace( std::ostream & os )
+{
+  using namespace detail;
+  struct ThreadTrace
+  {
+    std::size_t threadIndex;
+    std::string name;
+    std::vector<TraceBuffer::Snapshot> events;
+  };
+  std::vector<ThreadTrace> threads;
+  const TraceClock clock;
+  traceBuffers()( [&]( const TraceBuffers & buffers )
+  {
+    for ( const auto & buffer : buffers )
+      threads.push_back( { buffer->threadIndex,
+                           buffer->threadName.load(),
+                           buffer->snapshot() } );
+  } );
+
+  struct Location
+  {
+    std::uint64_t time;
+    std::size_t threadIndex;
+  };
+  std::unordered_map<TraceTaskId, Location> begins;
+  std::unordered_map<TraceTaskId, Location> ends;
+  for ( const auto & thread : threads )
+    for ( const auto & event : thread.events )
+      if ( event.kind == TraceEventKind::begin )
+        begins[event.taskId] = { event.time, thread.threadIndex };
+      else if ( event.kind == TraceEventKind::end )
+        ends[event.taskId] = { event.time, thread.threadIndex };
+
+  auto first = true;
+  const auto separate = [&]
+  {
+    os << ( first ? "\n" : ",\n" );
+    first = false;
+  };
+  const auto writeEvent = [&]( const char * phase, const char * category,
+                               const std::string & name,
+                               const Location & location,
+                               const char * extra )
+  {
+    // The timestamps are written in microseconds with three decimals.
+    const auto time = clock.toNanoseconds( location.time );
+    separate();
+    os << "{\"ph\":\"" << phase << "\",\"cat\":\"" << category << "\",\"name\":";
+    writeJsonString( os, name );
+    os << ",\"pid\":1,\"tid\":" << location.threadIndex
+       << ",\"ts\":" << time / 1000 << '.'
+       << std::to_string( 1000 + time % 1000 ).substr( 1 )
+       << extra << '}';
+  };
+
+  os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+  std::uint64_t nEdges = 0;
+  for ( const auto & thread : threads )
+  {
+    if ( !thread.name.empty() )
+    {
+      separate();
+      os << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":"
+         << thread.threadIndex << ",\"args\":{\"name\":";
+      writeJsonString( os, thread.name );
+      os << "}}";
+    }
+    // Counts the open slices, so that end events whose begin event has
+    // been overwritten in the ring buffer are skipped.
+    std::size_t depth = 0;
+    for ( const auto & event : thread.events )
+    {
+      const Location here{ event.time, thread.threadIndex };
+      const auto id = std::to_string( event.taskId );
+      const auto idArg = ",\"id\":" + id;
+      switch ( event.kind )
+      {
+      case TraceEventKind::enqueue:
+        writeEvent( "i", "enqueue", "enqueue " + id, here, ",\"s\":\"t\"" );
+        if ( begins.count( event.taskId ) )
+        {
+          writeEvent( "s", "enqueue", "enqueue", here, idArg.c_str() );
+          writeEvent( "f", "enqueue", "enqueue", begins[event.taskId],
+                      ( idArg + ",\"bp\":\"e\"" ).c_str() );
+        }
+        break;
+      case TraceEventKind::begin:
+        ++depth;
+        writeEvent( "B", "task",
+                    std::string( reinterpret_cast<const char *>( event.other ) )
+                    + " task " + id, here, "" );
+        break;
+      case TraceEventKind::end:
+        if ( depth == 0 )
+          break;
+        --depth;
+        writeEvent( "E", "task", "", here, "" );
+        break;
+      case TraceEventKind::edge:
+        if ( ends.count( event.other ) && begins.count( event.taskId ) )
+        {
+          const auto edgeArg = ",\"id\":" + std::to_string( ++nEdges );
+          writeEvent( "s", "dependency", "dependency", ends[event.other],
+                      edgeArg.c_str() );
+          writeEvent( "f", "dependency", "dependency", begins[event.taskId],
+                      ( edgeArg + ",\"bp\":\"e\"" ).c_str() );
+        }
+        break;
+      }
+    }
+  }
+  os << "\n]}\n";
+}
+
+#else // CU_ENABLE_TRACING
+
+namespace detail
+{
+  /// Stands in for the id of a traced task, if tracing is disabled.
+  struct TraceTaskId {};
+
+  inline TraceTaskId newTraceTaskId() noexcept
+  {
+    return {};
+  }
+
+  inline void traceEnqueue( TraceTaskId ) noexcept
+  {}
+
+  inline void traceEdge( TraceTaskId, TraceTaskId ) noexcept
+  {}
+
+  template <typename F>
+  F && makeTracedTask( const char *, TraceTaskId, F && f ) noexcept
+  {
+    return std::forward<F>(f);
+  }
+
+  template <typename F>
+  F && makeTracedTask( const char *, F && f ) noexcept
+  {
+    return std::forward<F>(f);
+  }
+} // namespace detail
+
+template <typename String>
+void setTraceThreadName( String && ) noexcept
+{}
+
+inline void clearTrace() noexcept
+{}
+
+/// Writes an empty trace, since tracing is disabled.
+inline void writeChromeTrace( std::ostream & os )
+{
+  os << "{\"traceEvents\":[]}\n";
+}
+
+#endif // CU_ENABLE_TRACING
+
+} // namespace cu
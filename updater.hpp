@@ -6,11 +6,33 @@
 
 #include "functors.hpp"
 #include "monitor.hpp"
+#include "rank.hpp"
+#include <cassert>
 #include <condition_variable>
 
 namespace cu
 {
 
+namespace detail
+{
+  /// Calls @c executor.post(f), if the executor provides it, since then no
+  /// future needs to be created. Otherwise @c executor(f) is called.
+  template <typename Executor,
+            typename F>
+  auto postToExecutor( Executor & executor, F && f, Rank<1> )
+    -> decltype( executor.post( std::forward<F>(f) ), void() )
+  {
+    executor.post( std::forward<F>(f) );
+  }
+
+  template <typename Executor,
+            typename F>
+  void postToExecutor( Executor & executor, F && f, Rank<0> )
+  {
+    executor( std::forward<F>(f) );
+  }
+} // namespace detail
+
 /// A class wrapping an executor for executing updating operations.
 ///
 /// If there might be too many expensive updating tasks for a
@@ -36,7 +58,7 @@ private:
 
   void runExecutor()
   {
-    executor( [this]( TaskArgs ... taskArgs )
+    detail::postToExecutor( executor, [this]( TaskArgs ... taskArgs )
     {
       MoveFunction<void(TaskArgs&&...)> task;
       data( [&]( Data & data )
@@ -59,7 +81,7 @@ private:
 
       if ( runAgain )
         runExecutor();
-    });
+    }, Rank<1>{} );
   }
 
 public:
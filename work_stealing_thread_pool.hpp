@@ -0,0 +1,314 @@
+/** @file Defines the class @c WorkStealingThreadPool.
+ * @author Ralph Tandetzky
+ */
+
+#pragma once
+
+#include "c++17_features.hpp"
+#include "event_count.hpp"
+#include "functors.hpp"
+#include "memory_helpers.hpp"
+#include "monitor.hpp"
+#include "task_queue.hpp"
+#include "thread_affinity.hpp"
+#include "tracing.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <future>
+#include <memory>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+namespace cu
+{
+
+/// A task dispatching thread pool with one task deque per worker.
+///
+/// Tasks are added with the function call operator or @c post() like in
+/// @c TaskQueueThreadPool. Unlike there, there are no priorities, no
+/// elastic mode, no helping @c wait() and @c get() and no coroutine
+/// support. In exchange, there is no single queue which all workers
+/// contend for. Instead, each worker owns a deque with its own mutex. A
+/// worker pops tasks from the back of its own deque (LIFO), which keeps
+/// recently produced data hot in its cache. An idle worker steals tasks
+/// from the front of the deques of other workers (FIFO). Workers only park,
+/// if they could neither pop nor steal anything.
+///
+/// Tasks which are submitted from within a worker of the pool go to the
+/// deque of that worker. Tasks from other threads go to a global FIFO
+/// queue, which the workers check before their own deques. Hence, they are
+/// started in the order of submission and cannot be starved by workers
+/// which keep producing tasks for their own deques.
+///
+/// The workers can be pinned to CPUs or spread over the NUMA nodes of the
+/// machine, see @c WorkerPlacement.
+///
+/// @note The @c WorkerData will be assigned to each thread in the thread pool
+/// making the data thread-local in effect (as long as the types aren't
+/// references). As in @c TaskQueueThreadPool, each worker copy-constructs its
+/// data on its own thread after its affinity has been set, or moves it, if
+/// the data cannot be copied.
+template <typename ...WorkerData>
+class WorkStealingThreadPool
+{
+private:
+  using Task = MoveFunction<void(WorkerData&...)>;
+
+  struct alignas(cacheLineSize) Worker
+  {
+    Monitor<std::deque<Task>> tasks;
+    std::thread thread;
+  };
+
+  using Startup = detail::WorkerStartup;
+
+  /// Identifies the pool and the worker index of the current thread.
+  struct CurrentWorker
+  {
+    const WorkStealingThreadPool * pool = nullptr;
+    std::size_t index = 0;
+  };
+
+  static CurrentWorker & currentWorker()
+  {
+    static thread_local CurrentWorker result;
+    return result;
+  }
+
+  detail::WorkerDataFactory<WorkerData...> makeWorkerData;
+  std::vector<std::unique_ptr<Worker>> workers;
+  /// The tasks submitted by threads outside the pool.
+  alignas(cacheLineSize) Monitor<std::deque<Task>> injectedTasks;
+  /// The size of @c injectedTasks, which can be read without locking.
+  std::atomic<std::size_t> nInjectedTasks{0};
+  std::atomic<bool> done{false};
+  EventCount idle;
+
+  static std::size_t computeNWorkers(
+      std::size_t nThreads, WorkerPlacement placement )
+  {
+    if ( nThreads != 0 )
+      return nThreads;
+
+    if ( placement != WorkerPlacement::unpinned )
+      return availableCpus().size();
+
+    return std::max( std::size_t{1}, std::size_t(std::thread::hardware_concurrency()) );
+  }
+
+  /// Pops from the front of the injected tasks, from the back of the own
+  /// deque or steals from the front of the deque of another worker.
+  optional<Task> findTask( std::size_t index )
+  {
+    if ( nInjectedTasks.load( std::memory_order_relaxed ) != 0 )
+    {
+      auto result = injectedTasks( [this]( std::deque<Task> & tasks ) -> optional<Task>
+      {
+        if ( tasks.empty() )
+          return nullopt;
+        auto task = std::move( tasks.front() );
+        tasks.pop_front();
+        nInjectedTasks.store( tasks.size(), std::memory_order_relaxed );
+        return task;
+      } );
+      if ( result )
+        return result;
+    }
+    auto result = workers[index]->tasks( []( std::deque<Task> & tasks ) -> optional<Task>
+    {
+      if ( tasks.empty() )
+        return nullopt;
+      auto task = std::move( tasks.back() );
+      tasks.pop_back();
+      return task;
+    } );
+    for ( std::size_t i = 1; !result && i < workers.size(); ++i )
+    {
+      result = workers[(index + i) % workers.size()]->tasks(
+            []( std::deque<Task> & tasks ) -> optional<Task>
+      {
+        if ( tasks.empty() )
+          return nullopt;
+        auto task = std::move( tasks.front() );
+        tasks.pop_front();
+        return task;
+      } );
+    }
+    return result;
+  }
+
+  void run( std::size_t index,
+            const std::vector<unsigned> & cpus,
+            Startup & startup )
+  {
+    setCurrentThreadAffinity( cpus );
+    setTraceThreadName( "WorkStealingThreadPool worker" );
+    optional<std::tuple<WorkerData...>> workerData;
+    try
+    {
+      workerData.emplace( makeWorkerData() );
+    }
+    catch ( ... )
+    {
+      startup.errors[index] = std::current_exception();
+    }
+    // After this, the startup data must not be accessed anymore.
+    startup.reportStarted();
+    if ( !workerData )
+      return;
+
+    currentWorker() = { this, index };
+    for (;;)
+    {
+      auto task = findTask( index );
+      if ( !task )
+      {
+        idle.wait( [&]{ task = findTask( index ); return task || done; } );
+        if ( !task )
+          break;
+      }
+      cu::apply( *task, *workerData );
+    }
+  }
+
+  /// Lets the workers dispatch all remaining tasks and joins them.
+  void stopWorkers() noexcept
+  {
+    done = true;
+    idle.notifyAll();
+    for ( const auto & worker : workers )
+      if ( worker->thread.joinable() )
+        worker->thread.join();
+  }
+
+  void pushTask( Task task )
+  {
+    const auto & current = currentWorker();
+    if ( current.pool == this )
+    {
+      workers[current.index]->tasks( [&]( std::deque<Task> & tasks )
+      {
+        tasks.push_back( std::move(task) );
+      } );
+    }
+    else
+    {
+      injectedTasks( [&]( std::deque<Task> & tasks )
+      {
+        tasks.push_back( std::move(task) );
+        nInjectedTasks.store( tasks.size(), std::memory_order_relaxed );
+      } );
+    }
+    idle.notifyOne();
+  }
+
+public:
+  /// Blocks until all tasks have been dispatched and joins the workers.
+  ~WorkStealingThreadPool()
+  {
+    stopWorkers();
+  }
+
+  /// Starts the task dispatching loops of the thread pool.
+  ///
+  /// @param nThreads The number of workers. If it is zero, then the number
+  /// of CPUs is used.
+  /// @param placement Selects on which CPUs the workers run.
+  /// @param workerData The arguments each worker copies its worker data from
+  /// or moves it from, if it is move-only.
+  explicit WorkStealingThreadPool(
+      std::size_t nThreads,
+      WorkerPlacement placement,
+      WorkerData &&... workerData )
+    : makeWorkerData( detail::makeWorkerDataFactory<WorkerData...>(
+                        std::forward<WorkerData>(workerData)... ) )
+  {
+    nThreads = computeNWorkers( nThreads, placement );
+    const auto cpuSets = computeWorkerCpuSets( placement, nThreads );
+    Startup startup( nThreads );
+
+    workers.reserve( nThreads );
+    for ( auto i = 0*nThreads; i < nThreads; ++i )
+      workers.push_back( std::make_unique<Worker>() );
+    std::size_t nLaunched = 0;
+    try
+    {
+      for ( ; nLaunched < nThreads; ++nLaunched )
+      {
+        const auto i = nLaunched;
+        workers[i]->thread = std::thread( [this, i, &cpuSets, &startup]
+        {
+          run( i, cpuSets[i], startup );
+        } );
+      }
+    }
+    catch ( ... )
+    {
+      startup.waitUntilStarted( nLaunched );
+      stopWorkers();
+      throw;
+    }
+    startup.waitUntilStarted( nThreads );
+
+    for ( const auto & error : startup.errors )
+    {
+      if ( error )
+      {
+        stopWorkers();
+        std::rethrow_exception( error );
+      }
+    }
+  }
+
+  explicit WorkStealingThreadPool(
+      std::size_t nThreads,
+      WorkerData &&... workerData )
+    : WorkStealingThreadPool( nThreads, WorkerPlacement::unpinned,
+                              std::forward<WorkerData>(workerData)... )
+  {}
+
+  explicit WorkStealingThreadPool(
+      WorkerData &&... workerData )
+    : WorkStealingThreadPool( 0, std::forward<WorkerData>(workerData)... )
+  {}
+
+  /// Adds a task to the pool.
+  ///
+  /// If the calling thread is a worker of this pool, then the task is
+  /// pushed to the deque of this worker. Otherwise it is appended to the
+  /// global queue of injected tasks.
+  ///
+  /// @returns A @c std::future for the result.
+  template <typename F>
+  auto operator()( F && f )
+  {
+    auto taskAndFuture =
+        detail::makePackagedTask<WorkerData&...>(
+          detail::makeTracedTask( "WorkStealingThreadPool", std::forward<F>(f) ) );
+    pushTask( std::move(taskAndFuture.first) );
+    return std::move(taskAndFuture.second);
+  }
+
+  /// Adds a task to the pool without creating a future.
+  ///
+  /// Exceptions escaping the task are passed to @c cu::handleException().
+  template <typename F>
+  void post( F && f )
+  {
+    pushTask( detail::makeExceptionHandlingTask<WorkerData&...>(
+                detail::makeTracedTask( "WorkStealingThreadPool",
+                                        std::forward<F>(f) ) ) );
+  }
+
+  /// Returns the number of worker threads.
+  std::size_t workerCount() const noexcept
+  {
+    return workers.size();
+  }
+};
+
+} // namespace cu